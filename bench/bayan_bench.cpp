@@ -0,0 +1,515 @@
+/// @file   bayan_bench.cpp
+/// @brief  This file contains microbenchmarks of hot paths of search engine.
+/// @author griha
+
+#include "search_engine.h"
+#include "path_filter.h"
+#include "block_hasher.h"
+#include "kernel_hash.h"
+#include "heap_stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/container/map.hpp>
+
+#include <benchmark/benchmark.h>
+
+namespace fs = boost::filesystem;
+namespace cont = boost::container;
+
+using namespace griha;
+
+namespace {
+
+/// @brief Hook counting allocations by global @c operator @c new of all threads while enabled
+std::atomic<bool> g_count_allocations { false };
+std::atomic<uint64_t> g_allocations { 0 };
+
+void* allocate(size_t size) {
+    if (g_count_allocations.load(std::memory_order_relaxed))
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ret = std::malloc(size != 0 ? size : 1))
+        return ret;
+    throw std::bad_alloc {};
+}
+
+/// @brief Counts allocations until it's destroyed
+/// @note Allocations done by C library itself, e.g. by @c fdopen, aren't counted
+struct AllocationScope {
+    AllocationScope() {
+        g_allocations = 0;
+        g_count_allocations = true;
+    }
+
+    ~AllocationScope() {
+        g_count_allocations = false;
+    }
+
+    uint64_t count() const { return g_allocations; }
+};
+
+} // unnamed namespace
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+/// @brief Number of distinct inputs benchmarks cycle through
+constexpr size_t c_samples = 1024;
+
+/// @brief Directories commonly excluded from scanning of home directory
+const char* const c_exclude_names[] = {
+    ".git", "node_modules", "build", ".cache", "__pycache__", "target", "vendor", ".svn",
+    "tmp", ".local/share/Trash", "dist", ".venv", "Library/Caches", ".gradle", "obj", ".idea"
+};
+
+/// @brief Extensions of file name patterns
+const char* const c_extensions[] = {
+    "jpg", "jpeg", "png", "gif", "mp3", "flac", "mp4", "mkv",
+    "pdf", "doc", "docx", "zip", "tar", "gz", "iso", "txt"
+};
+
+/// @brief Generates relative paths of files of depth from 1 to 8
+std::vector<fs::path> make_paths(std::mt19937& rnd) {
+    std::vector<fs::path> ret;
+    for (size_t i = 0; i < c_samples; ++i) {
+        fs::path p;
+        const size_t depth = 1 + rnd() % 8;
+        for (size_t d = 0; d < depth; ++d) {
+            if (rnd() % 8 == 0)
+                p /= c_exclude_names[rnd() % std::size(c_exclude_names)];
+            else
+                p /= "dir" + std::to_string(rnd() % 64);
+        }
+        p /= "file" + std::to_string(i) + "." + c_extensions[rnd() % std::size(c_extensions)];
+        ret.push_back(std::move(p));
+    }
+    return ret;
+}
+
+void BM_HashBlock(benchmark::State& state) {
+    const auto algo = static_cast<hash_algo>(state.range(0));
+    const auto size = static_cast<size_t>(state.range(1));
+
+    BlockHasher hasher { algo };
+    std::vector<char> data(size, 0x5a);
+    hasher.hash(data.data(), data.size()); // warm-up sizes buffers of filters
+
+    AllocationScope allocations;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hasher.hash(data.data(), data.size()).data());
+    if (allocations.count() != 0)
+        state.SkipWithError("hashing of block allocates");
+
+    state.SetBytesProcessed(state.iterations() * size);
+    state.SetLabel(algo == hash_algo::md5 ? "md5" : "sha256");
+}
+BENCHMARK(BM_HashBlock)
+    ->ArgsProduct({ { static_cast<int64_t>(hash_algo::md5), static_cast<int64_t>(hash_algo::sha256) },
+                    benchmark::CreateRange(512, 1 << 20, 8) });
+
+/// @brief Hashing of block of file by kernel crypto API to compare with @c BM_HashBlock
+/// @details File is written once and stays in page cache, so pages are spliced into
+///          @c AF_ALG socket without reading from storage
+void BM_KernelHash(benchmark::State& state) {
+    const auto algo = static_cast<hash_algo>(state.range(0));
+    const auto size = static_cast<size_t>(state.range(1));
+
+    KernelHash hasher { algo };
+    if (!hasher.valid()) {
+        state.SkipWithError("AF_ALG hash sockets aren't supported");
+        return;
+    }
+
+    const auto file_path = fs::temp_directory_path() / fs::unique_path("bayan-bench-%%%%-%%%%");
+    std::ofstream { file_path.string() } << std::string(size, 0x5a);
+    int fd = open(file_path.c_str(), O_RDONLY);
+    fs::remove(file_path);
+    if (fd == -1) {
+        state.SkipWithError("failed to open block file");
+        return;
+    }
+
+    std::string digest;
+    for (auto _ : state) {
+        if (hasher.digest(fd, 0, size, digest) != static_cast<ssize_t>(size)) {
+            state.SkipWithError("kernel hashing failed");
+            break;
+        }
+        benchmark::DoNotOptimize(digest.data());
+    }
+    close(fd);
+
+    state.SetBytesProcessed(state.iterations() * size);
+    state.SetLabel(algo == hash_algo::md5 ? "md5" : "sha256");
+}
+BENCHMARK(BM_KernelHash)
+    ->ArgsProduct({ { static_cast<int64_t>(hash_algo::md5), static_cast<int64_t>(hash_algo::sha256) },
+                    benchmark::CreateRange(512, 1 << 20, 8) });
+
+/// @brief Arguments: number of excluded paths
+void BM_IsExcluded(benchmark::State& state) {
+    std::mt19937 rnd;
+    const fs::path root { "/home/user" };
+    const auto paths = make_paths(rnd);
+
+    SearchEngine::paths_type paths_exclude;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        if (static_cast<size_t>(i) < std::size(c_exclude_names))
+            paths_exclude.emplace_back(c_exclude_names[i]);
+        else
+            paths_exclude.emplace_back(fs::path { "dir" + std::to_string(i % 64) } / "sub");
+    }
+
+    std::vector<fs::path> absolute;
+    for (const auto& p : paths)
+        absolute.push_back(root / p);
+
+    size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(is_excluded(absolute[i++ % c_samples], root, paths_exclude));
+}
+BENCHMARK(BM_IsExcluded)->Arg(0)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+/// @brief Arguments: number of patterns
+void BM_MatchAny(benchmark::State& state) {
+    std::mt19937 rnd;
+    const auto paths = make_paths(rnd);
+
+    SearchEngine::rxpatterns_type patterns;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        const size_t n = i % std::size(c_extensions);
+        patterns.emplace_back(i < static_cast<int64_t>(std::size(c_extensions)) ?
+            std::string { ".*\\." } + c_extensions[n] :
+            "file" + std::to_string(i) + ".*\\." + c_extensions[n]);
+    }
+
+    size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(match_any(paths[i++ % c_samples], patterns));
+}
+BENCHMARK(BM_MatchAny)->Arg(0)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+/// @brief Lookup of child by digest of block as it's done by @c Node::childs
+/// @details Container and keys are the same as ones of nodes of trees, value stands for child node.
+///          Digest is copied into reused key like worker does, existing child is found
+///          without allocation.
+/// @note Arguments: number of childs of node
+void BM_NodeChilds(benchmark::State& state) {
+    const auto fanout = static_cast<size_t>(state.range(0));
+
+    BlockHasher hasher { hash_algo::md5 };
+    cont::map<std::string, std::vector<fs::path>, std::less<std::string>,
+        CountingAllocator<std::pair<const std::string, std::vector<fs::path>>, heap_category::nodes>> childs;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < fanout; ++i) {
+        const auto block = std::to_string(i);
+        keys.push_back(hasher.hash(block.data(), block.size()));
+        childs[keys.back()];
+    }
+
+    std::mt19937 rnd;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < c_samples; ++i)
+        order.push_back(rnd() % fanout);
+
+    std::string key;
+    key.reserve(keys.front().size());
+
+    size_t i = 0;
+    AllocationScope allocations;
+    for (auto _ : state) {
+        key = keys[order[i++ % c_samples]];
+        benchmark::DoNotOptimize(&childs.try_emplace(key).first->second);
+    }
+    if (allocations.count() != 0)
+        state.SkipWithError("lookup of existing child allocates");
+}
+BENCHMARK(BM_NodeChilds)->RangeMultiplier(4)->Range(1, 4096);
+
+/// @brief Directory of synthetic files removed on exit
+struct Corpus {
+    fs::path root;
+
+    /// @param files Number of files, they are grouped by 2 to 4 duplicates
+    explicit Corpus(size_t files)
+        : root(fs::temp_directory_path() / fs::unique_path("bayan-bench-%%%%-%%%%")) {
+
+        fs::create_directories(root);
+
+        std::mt19937 rnd;
+        for (size_t i = 0; i < files; ) {
+            const size_t copies = 2 + rnd() % 3;
+            const std::string content(128 + rnd() % 64, static_cast<char>('a' + i % 26));
+            const auto tag = std::to_string(i);
+            for (size_t c = 0; c < copies && i < files; ++c, ++i) {
+                const auto dir = root / std::to_string(i % 32);
+                fs::create_directories(dir);
+                std::ofstream { (dir / ("f" + std::to_string(i))).string() } << tag << content;
+            }
+        }
+    }
+
+    ~Corpus() {
+        boost::system::error_code ec;
+        fs::remove_all(root, ec);
+    }
+};
+
+/// @brief Directory of identical files removed on exit
+struct Duplicates {
+    fs::path root;
+
+    Duplicates(size_t files, size_t file_size)
+        : root(fs::temp_directory_path() / fs::unique_path("bayan-bench-%%%%-%%%%")) {
+
+        fs::create_directories(root);
+        const std::string content(file_size, 'd');
+        for (size_t i = 0; i < files; ++i)
+            std::ofstream { (root / ("f" + std::to_string(i))).string() } << content;
+    }
+
+    ~Duplicates() {
+        boost::system::error_code ec;
+        fs::remove_all(root, ec);
+    }
+};
+
+/// @return Parameters of engine scanning directory by one thread of each stage
+SearchEngine::InitParams scan_params(const fs::path& root, size_t block_size, size_t small_file_size) {
+    SearchEngine::InitParams ret;
+    ret.block_size = block_size;
+    ret.small_file_size = small_file_size;
+    ret.large_file_size = 0;
+    ret.traversal_concurrency = 1;
+    ret.ssd_concurrency = 1;
+    ret.hash_concurrency = 1;
+    ret.paths_scan = { root };
+    return ret;
+}
+
+/// @return Number of allocations of scanning of identical files of @c blocks blocks
+uint64_t scan_allocations(size_t files, size_t blocks) {
+    constexpr size_t c_block_size = 1024;
+
+    Duplicates corpus { files, blocks * c_block_size };
+    SearchEngine engine { scan_params(corpus.root, c_block_size, 0) };
+    engine.run(true); // warm-up
+
+    AllocationScope allocations;
+    engine.run(true);
+    return allocations.count();
+}
+
+/// @brief Allocations of scanning per file, they mustn't grow with number of blocks
+/// @details Files are identical, so each of them is read to the end. The first file
+///          creates chain of nodes one per block, node and its key take a few allocations.
+///          Other files follow the chain, so steady state of comparing of blocks is
+///          allocation-free if scanning of longer files allocates no more than the chain
+///          takes, it doesn't depend on number of files.
+/// @note Arguments: number of blocks of file
+void BM_ScanAllocs(benchmark::State& state) {
+    constexpr size_t c_files = 256;
+    constexpr size_t c_chain_allocations = 4; ///< allocations per node of chain, node and key are 2 now
+    const auto blocks = static_cast<size_t>(state.range(0));
+
+    const auto base = scan_allocations(c_files, 1);
+    uint64_t allocations = 0;
+    for (auto _ : state)
+        allocations = scan_allocations(c_files, blocks);
+
+    state.counters["allocs_per_file"] = static_cast<double>(allocations) / c_files;
+    if (allocations > base + c_chain_allocations * (blocks - 1))
+        state.SkipWithError("comparing of blocks allocates");
+}
+BENCHMARK(BM_ScanAllocs)->Arg(1)->Arg(8)->Arg(64)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+/// @brief Executor running tasks by thread of benchmark in order they are posted
+struct QueueExecutor {
+    std::mutex guard;
+    std::condition_variable cv;
+    std::deque<SearchEngine::task_type> tasks;
+
+    void post(SearchEngine::task_type task) {
+        {
+            std::lock_guard<std::mutex> lock { guard };
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+    /// @brief Runs tasks until @c done is set by one of them
+    void run(const bool& done) {
+        while (!done) {
+            SearchEngine::task_type task;
+            {
+                std::unique_lock<std::mutex> lock { guard };
+                cv.wait(lock, [this] { return !tasks.empty(); });
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+enum class async_stop {
+    none,
+    cancel,
+    deadline
+};
+
+/// @brief Asynchronous scanning completed, cancelled or stopped by deadline
+/// @details Reading of stopped scanning is throttled, so it's stopped while files are
+///          compared. Benchmark fails if completion gets unexpected error, if any group is
+///          passed after completion or if groups passed to @c on_group of completed scanning
+///          differ from ones left in engine. Time is measured from start of completed
+///          scanning or from request to stop until completion handler is called.
+/// @note Arguments: way scanning is stopped
+void BM_RunAsync(benchmark::State& state) {
+    constexpr size_t c_files = 64;
+    constexpr size_t c_block_size = 1024;
+    const auto stop = static_cast<async_stop>(state.range(0));
+
+    Duplicates corpus { c_files, 64 * c_block_size };
+    auto params = scan_params(corpus.root, c_block_size, 0);
+    params.max_read_rate = stop == async_stop::none ? 0 : 256 * c_block_size;
+    SearchEngine engine { std::move(params) };
+
+    for (auto _ : state) {
+        QueueExecutor executor;
+        bool done = false, late = false;
+        size_t groups = 0;
+        std::exception_ptr error;
+
+        SearchEngine::AsyncParams async;
+        async.recursive = true;
+        async.executor = [&executor] (SearchEngine::task_type task) { executor.post(std::move(task)); };
+        async.on_group = [&] (const SearchEngine::Iterator::Accessor&) {
+            late = late || done;
+            ++groups;
+        };
+        async.on_complete = [&] (std::exception_ptr e) {
+            error = e;
+            done = true;
+        };
+        auto start = std::chrono::steady_clock::now();
+        if (stop == async_stop::deadline)
+            async.deadline = start += std::chrono::milliseconds { 100 };
+        auto token = async.token;
+
+        engine.run_async(std::move(async));
+        if (stop == async_stop::cancel) {
+            std::this_thread::sleep_for(std::chrono::milliseconds { 100 });
+            token.cancel();
+            start = std::chrono::steady_clock::now();
+        }
+
+        executor.run(done);
+        engine.wait();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        state.SetIterationTime(elapsed.count());
+
+        // tasks posted after completion are run to catch late groups
+        while (!executor.tasks.empty()) {
+            executor.tasks.front()();
+            executor.tasks.pop_front();
+        }
+        if (late) {
+            state.SkipWithError("group is passed after completion");
+            break;
+        }
+
+        if (stop == async_stop::none) {
+            size_t left = 0;
+            for (const auto& v : engine)
+                left += v.size() > 1 ? 1 : 0;
+            if (error || groups != left) {
+                state.SkipWithError("groups passed differ from ones left in engine");
+                break;
+            }
+            continue;
+        }
+
+        const auto expected = stop == async_stop::cancel ? std::errc::operation_canceled : std::errc::timed_out;
+        try {
+            if (error)
+                std::rethrow_exception(error);
+            state.SkipWithError("scanning isn't stopped");
+            break;
+        } catch (const std::system_error& e) {
+            if (e.code() != std::make_error_code(expected)) {
+                state.SkipWithError("scanning is stopped by unexpected error");
+                break;
+            }
+        } catch (...) {
+            state.SkipWithError("scanning is stopped by unexpected error");
+            break;
+        }
+    }
+
+    state.SetLabel(stop == async_stop::none ? "complete" : stop == async_stop::cancel ? "cancel" : "deadline");
+}
+BENCHMARK(BM_RunAsync)
+    ->Arg(static_cast<int64_t>(async_stop::none))
+    ->Arg(static_cast<int64_t>(async_stop::cancel))
+    ->Arg(static_cast<int64_t>(async_stop::deadline))
+    ->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+/// @brief Scanned engine for each corpus size, corpus is built and scanned once
+SearchEngine& scanned(size_t files) {
+    struct Entry {
+        std::unique_ptr<Corpus> corpus;
+        std::unique_ptr<SearchEngine> engine;
+    };
+    static std::map<size_t, Entry> cache;
+
+    auto& e = cache[files];
+    if (!e.engine) {
+        e.corpus.reset(new Corpus { files });
+        e.engine.reset(new SearchEngine { scan_params(e.corpus->root, 1024, 4096) });
+        e.engine->run(true);
+    }
+    return *e.engine;
+}
+
+/// @brief Full iteration over groups of duplicates and their files
+/// @note Arguments: number of files scanned
+void BM_Iterate(benchmark::State& state) {
+    const auto& engine = scanned(static_cast<size_t>(state.range(0)));
+
+    size_t files = 0;
+    for (auto _ : state) {
+        for (const auto& v : engine)
+            v.visit([&files] (const fs::path&) { ++files; });
+    }
+
+    state.SetItemsProcessed(files);
+}
+BENCHMARK(BM_Iterate)->RangeMultiplier(8)->Range(64, 32768)->Unit(benchmark::kMicrosecond);
+
+} // unnamed namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,123 @@
+/// @file   bayan_gen.cpp
+/// @brief  This file contains tool generating synthetic directory corpora for benchmarking.
+/// @author griha
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include "corpus.h"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+namespace {
+
+void usage(const char* argv0, std::ostream& os, const po::options_description& opts_desc) {
+    os << "Usage:" << std::endl
+       << '\t' << fs::path{ argv0 }.stem().string() << " [options] <corpus-path>" << std::endl
+       << '\t' << opts_desc << std::endl;
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[]) {
+    using namespace griha;
+
+    const CorpusParams c_default;
+
+    bool opt_help, opt_evict;
+    fs::path root, shape_file;
+    CorpusParams params;
+
+    // command line options
+    po::options_description generic { "Options" };
+    generic.add_options()
+            ("help,h", po::bool_switch(&opt_help), "prints out this message")
+            ("seed", po::value(&params.seed)->default_value(c_default.seed),
+                     "seed corpus is reproduced from")
+            ("files,n", po::value(&params.files)->default_value(c_default.files), "number of files")
+            ("min-size", po::value(&params.min_size)->default_value(c_default.min_size),
+                         "minimum size of file, sizes are distributed log-uniformly")
+            ("max-size", po::value(&params.max_size)->default_value(c_default.max_size),
+                         "maximum size of file")
+            ("duplicate-ratio", po::value(&params.duplicate_ratio)->default_value(c_default.duplicate_ratio),
+                                "share of files which have duplicates")
+            ("group-min", po::value(&params.group_min)->default_value(c_default.group_min),
+                          "minimum number of files of group of duplicates")
+            ("group-max", po::value(&params.group_max)->default_value(c_default.group_max),
+                          "maximum number of files of group of duplicates")
+            ("same-size-ratio", po::value(&params.same_size_ratio)->default_value(c_default.same_size_ratio),
+                                "share of unique files having size of other file")
+            ("shared-prefix", po::value(&params.shared_prefix)->default_value(c_default.shared_prefix),
+                              "number of leading bytes shared by files of the same size")
+            ("depth", po::value(&params.depth)->default_value(c_default.depth), "maximum depth of directories")
+            ("fanout", po::value(&params.fanout)->default_value(c_default.fanout),
+                       "number of sub-directories of directory")
+            ("sparse-ratio", po::value(&params.sparse_ratio)->default_value(c_default.sparse_ratio),
+                             "share of files consisting of holes except head and tail blocks")
+            ("zero-ratio", po::value(&params.zero_ratio)->default_value(c_default.zero_ratio),
+                           "share of files filled by zeros")
+            ("hardlink-ratio", po::value(&params.hardlink_ratio)->default_value(c_default.hardlink_ratio),
+                               "share of duplicates created as hard links")
+            ("replay", po::value(&shape_file),
+                       "generate corpus shaped as scanning recorded by bayan --record-shape, "
+                       "parameters of synthetic corpus are ignored")
+            ("evict", po::bool_switch(&opt_evict),
+                      "drop files of existing corpus from page cache instead of generating");
+
+    // Next options allowed at command line, but isn't shown in help
+    po::options_description hidden {};
+    hidden.add_options()("corpus-path", po::value(&root));
+    po::positional_options_description pos;
+    pos.add("corpus-path", 1);
+
+    po::options_description cmd_line, visible;
+    cmd_line.add(generic).add(hidden);
+    visible.add(generic);
+
+    po::variables_map opts;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(cmd_line).positional(pos).run(), opts);
+        notify(opts);
+    } catch (...) {
+        usage(argv[0], std::cerr, visible);
+        return EXIT_FAILURE;
+    }
+
+    if (opt_help) {
+        usage(argv[0], std::cout, visible);
+        return EXIT_SUCCESS;
+    }
+
+    if (root.empty() || params.group_min < 2 || params.group_max < params.group_min ||
+        params.min_size > params.max_size) {
+        usage(argv[0], std::cerr, visible);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if (opt_evict) {
+            std::cout << "evicted " << evict_corpus(root) << " files" << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        if (!shape_file.empty()) {
+            std::ifstream is { shape_file.string() };
+            if (!is)
+                throw std::runtime_error { "failed to open " + shape_file.string() };
+            std::cout << replay_shape(is, root) << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        std::cout << generate_corpus(root, params) << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
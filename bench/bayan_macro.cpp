@@ -0,0 +1,182 @@
+/// @file   bayan_macro.cpp
+/// @brief  This file contains end-to-end benchmark running search engine over corpora.
+/// @author griha
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include "search_engine.h"
+#include "options.h"
+#include "corpus.h"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+namespace {
+
+void usage(const char* argv0, std::ostream& os, const po::options_description& opts_desc) {
+    os << "Usage:" << std::endl
+       << '\t' << fs::path{ argv0 }.stem().string() << " [options] <corpus-path> ..." << std::endl
+       << '\t' << opts_desc << std::endl;
+}
+
+/// @brief Counters of I/O of process from @c /proc/self/io
+struct IoCounters {
+    uintmax_t rchar = 0;      ///< bytes returned by read syscalls
+    uintmax_t syscr = 0;      ///< number of read syscalls
+    uintmax_t read_bytes = 0; ///< bytes fetched from storage
+};
+
+IoCounters io_counters() {
+    IoCounters ret;
+    std::ifstream is { "/proc/self/io" };
+    std::string key;
+    uintmax_t value;
+    while (is >> key >> value) {
+        if (key == "rchar:")
+            ret.rchar = value;
+        else if (key == "syscr:")
+            ret.syscr = value;
+        else if (key == "read_bytes:")
+            ret.read_bytes = value;
+    }
+    return ret;
+}
+
+/// @brief Resets peak resident set size of process, supported since Linux 4.0
+void reset_peak_rss() {
+    std::ofstream { "/proc/self/clear_refs" } << "5";
+}
+
+/// @return Peak resident set size of process in kilobytes
+uintmax_t peak_rss() {
+    std::ifstream is { "/proc/self/status" };
+    for (std::string key; is >> key; ) {
+        if (key == "VmHWM:") {
+            uintmax_t ret;
+            is >> ret;
+            return ret;
+        }
+        is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[]) {
+    using namespace griha;
+
+    constexpr auto c_default_runs = 3;
+    const SearchEngine::InitParams c_default;
+
+    bool opt_help, opt_cold;
+    size_t runs;
+    SearchEngine::InitParams params;
+
+    // command line options
+    po::options_description generic { "Options" };
+    generic.add_options()
+            ("help,h", po::bool_switch(&opt_help), "prints out this message")
+            ("runs", po::value(&runs)->default_value(c_default_runs), "number of runs")
+            ("cold", po::bool_switch(&opt_cold), "drop corpora from page cache before each run")
+            ("block-size,B", po::value(&params.block_size)->default_value(c_default.block_size),
+                             "size of block to compare files by")
+            ("small-size,s", po::value(&params.small_file_size)->default_value(c_default.small_file_size),
+                             "maximum size of file compared as a whole by single read")
+            ("large-size", po::value(&params.large_file_size)->default_value(c_default.large_file_size),
+                           "minimum size of file hashed by chunks in parallel, 0 - never")
+            ("io", po::value(&params.io)->default_value(c_default.io),
+                   "mode of reading of files: buffered|fadvise|direct")
+            ("reader", po::value(&params.reader)->default_value(c_default.reader),
+                       "reader of blocks: pread|stdio")
+            ("hdd-concurrency", po::value(&params.hdd_concurrency)->default_value(c_default.hdd_concurrency),
+                                "number of workers reading from rotational device")
+            ("ssd-concurrency", po::value(&params.ssd_concurrency)->default_value(c_default.ssd_concurrency),
+                                "number of workers reading from non-rotational device, 0 - number of CPUs");
+
+    // Next options allowed at command line, but isn't shown in help
+    po::options_description hidden {};
+    hidden.add_options()("corpus-path", po::value(&params.paths_scan));
+    po::positional_options_description pos;
+    pos.add("corpus-path", -1);
+
+    po::options_description cmd_line, visible;
+    cmd_line.add(generic).add(hidden);
+    visible.add(generic);
+
+    po::variables_map opts;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(cmd_line).positional(pos).run(), opts);
+        notify(opts);
+    } catch (...) {
+        usage(argv[0], std::cerr, visible);
+        return EXIT_FAILURE;
+    }
+
+    if (opt_help) {
+        usage(argv[0], std::cout, visible);
+        return EXIT_SUCCESS;
+    }
+
+    if (params.paths_scan.empty()) {
+        usage(argv[0], std::cerr, visible);
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "run\twall_ms\tengine_read\tread_syscalls\tread_chars\tstorage_read\tpeak_rss_kb\tgroups\tfiles"
+              << std::endl;
+
+    std::vector<double> walls;
+    for (size_t run = 0; run < runs; ++run) {
+        if (opt_cold) {
+            for (const auto& p : params.paths_scan)
+                evict_corpus(p);
+        }
+
+        SearchEngine sengine { params };
+
+        reset_peak_rss();
+        const auto io_before = io_counters();
+        const auto start = std::chrono::steady_clock::now();
+
+        sengine.run(true);
+
+        size_t groups = 0, files = 0;
+        for (const auto& v : sengine) {
+            if (v.size() < 2)
+                continue;
+            ++groups;
+            files += v.size();
+        }
+
+        const std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - start;
+        const auto io_after = io_counters();
+        walls.push_back(wall.count());
+
+        std::cout << run
+                  << '\t' << static_cast<uintmax_t>(wall.count())
+                  << '\t' << sengine.report().bytes_read
+                  << '\t' << io_after.syscr - io_before.syscr
+                  << '\t' << io_after.rchar - io_before.rchar
+                  << '\t' << io_after.read_bytes - io_before.read_bytes
+                  << '\t' << peak_rss()
+                  << '\t' << groups
+                  << '\t' << files << std::endl;
+    }
+
+    if (!walls.empty()) {
+        std::nth_element(walls.begin(), walls.begin() + walls.size() / 2, walls.end());
+        std::cout << "median wall time " << static_cast<uintmax_t>(walls[walls.size() / 2]) << " ms" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,342 @@
+/// @file   corpus.cpp
+/// @brief  This file contains definition of generator of synthetic directory corpora.
+/// @author griha
+
+#include "corpus.h"
+
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+namespace {
+
+constexpr size_t c_write_chunk_size = 64 * 1024;
+
+/// @brief Size of blocks written at head and tail of sparse file
+constexpr uintmax_t c_sparse_block_size = 4096;
+
+enum class content_kind {
+    data,
+    sparse,
+    zero
+};
+
+struct Content {
+    uintmax_t size;
+    uint64_t seed;
+    content_kind kind;
+};
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/// @name Sampling by raw output of @c std::mt19937_64 which is the same on all platforms
+/// @{
+uint64_t uniform(std::mt19937_64& rnd, uint64_t min, uint64_t max) {
+    return min + rnd() % (max - min + 1);
+}
+
+bool chance(std::mt19937_64& rnd, double p) {
+    return static_cast<double>(rnd() >> 11) * 0x1.0p-53 < p;
+}
+/// @}
+
+uintmax_t log_uniform_size(std::mt19937_64& rnd, const CorpusParams& params) {
+    const double lo = std::log(static_cast<double>(std::max<uintmax_t>(params.min_size, 1)));
+    const double hi = std::log(static_cast<double>(params.max_size) + 1.);
+    const double u = static_cast<double>(rnd() >> 11) * 0x1.0p-53;
+    const auto ret = static_cast<uintmax_t>(std::exp(lo + u * (hi - lo)));
+    return std::min(std::max(ret, params.min_size), params.max_size);
+}
+
+/// @brief Fills part of file by bytes of stream specified by seed
+/// @param pos Position of part in file
+void fill(char* data, uintmax_t pos, size_t size, uint64_t seed) {
+    for (size_t i = 0; i < size; ) {
+        const uint64_t word = splitmix64(seed + (pos + i) / 8);
+        for (size_t b = (pos + i) % 8; b < 8 && i < size; ++b, ++i)
+            data[i] = static_cast<char>(word >> (8 * b));
+    }
+}
+
+[[noreturn]] void throw_error(const char* what, const fs::path& file_path) {
+    throw fs::filesystem_error { what, file_path,
+        boost::system::error_code { errno, boost::system::system_category() } };
+}
+
+class Writer {
+public:
+    explicit Writer(const CorpusParams& params)
+        : params_(params)
+        , buffer_(c_write_chunk_size) {}
+
+    void write(const fs::path& file_path, const Content& c) {
+        int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throw_error("open", file_path);
+        BOOST_SCOPE_EXIT(fd) {
+            close(fd);
+        } BOOST_SCOPE_EXIT_END;
+
+        if (c.kind == content_kind::sparse && c.size > 2 * c_sparse_block_size) {
+            if (ftruncate(fd, c.size) == -1)
+                throw_error("ftruncate", file_path);
+            write(fd, file_path, c, 0, c_sparse_block_size);
+            const uintmax_t tail = (c.size - 1) & ~(c_sparse_block_size - 1);
+            write(fd, file_path, c, tail, c.size - tail);
+            return;
+        }
+
+        write(fd, file_path, c, 0, c.size);
+    }
+
+    /// @brief Writes file which content diverges from other files of the same size
+    ///        at levels given by path of node of tree of size bucket
+    /// @param runs Path of node as runs of the same indices of nodes
+    void write(const fs::path& file_path, uintmax_t size, uintmax_t level_size,
+               const std::vector<std::pair<uint64_t, uint64_t>>& runs) {
+        int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throw_error("open", file_path);
+        BOOST_SCOPE_EXIT(fd) {
+            close(fd);
+        } BOOST_SCOPE_EXIT_END;
+
+        // seed of level is folded from indices of nodes up to it, so files share content
+        // while they share nodes, levels after leaf are the same for files of leaf
+        uint64_t seed = splitmix64(params_.seed ^ size);
+        auto run = runs.begin();
+        uint64_t left = run != runs.end() ? run->second : 0;
+        for (uintmax_t pos = 0; pos < size; pos += level_size) {
+            uint64_t index = 0;
+            if (run != runs.end()) {
+                index = run->first + 1;
+                if (--left == 0 && ++run != runs.end())
+                    left = run->second;
+            }
+            seed = splitmix64(seed ^ index);
+            write(fd, file_path, Content { size, seed, content_kind::data }, pos,
+                  std::min(level_size, size - pos));
+        }
+    }
+
+private:
+    void write(int fd, const fs::path& file_path, const Content& c, uintmax_t offset, uintmax_t size) {
+        // files of the same size share leading bytes, last byte isn't shared so files differ
+        const uint64_t prefix_seed = splitmix64(params_.seed ^ c.size);
+        const uintmax_t prefix = std::min(params_.shared_prefix, c.size - 1);
+
+        for (uintmax_t pos = offset; pos < offset + size; ) {
+            const size_t n = std::min<uintmax_t>(c_write_chunk_size, offset + size - pos);
+            if (c.kind == content_kind::zero) {
+                std::fill_n(buffer_.data(), n, '\0');
+            } else {
+                fill(buffer_.data(), pos, n, c.seed);
+                if (pos < prefix)
+                    fill(buffer_.data(), pos, std::min<uintmax_t>(n, prefix - pos), prefix_seed);
+            }
+
+            const auto ret = pwrite(fd, buffer_.data(), n, pos);
+            if (ret <= 0)
+                throw_error("write", file_path);
+            pos += ret;
+        }
+    }
+
+private:
+    const CorpusParams& params_;
+    std::vector<char> buffer_;
+};
+
+} // unnamed namespace
+
+CorpusStats generate_corpus(const fs::path& root, const CorpusParams& params) {
+    CorpusStats ret;
+    std::mt19937_64 rnd { params.seed };
+    Writer writer { params };
+    std::vector<uintmax_t> sizes;
+
+    const auto make_path = [&] {
+        auto dir = root;
+        for (size_t d = uniform(rnd, 0, params.depth); d > 0; --d)
+            dir /= "d" + std::to_string(uniform(rnd, 0, std::max<size_t>(params.fanout, 1) - 1));
+        fs::create_directories(dir);
+        return dir / ("f" + std::to_string(ret.files + ret.links));
+    };
+
+    const auto make_content = [&] (uintmax_t size) {
+        const auto seed = rnd();
+        auto kind = content_kind::data;
+        if (chance(rnd, params.zero_ratio))
+            kind = content_kind::zero;
+        else if (chance(rnd, params.sparse_ratio))
+            kind = content_kind::sparse;
+        return Content { size, seed, kind };
+    };
+
+    // probability of group is chosen so that share of files having duplicates is as required
+    const double group_mean = (params.group_min + params.group_max) / 2.;
+    const double p = params.duplicate_ratio;
+    const double group_chance = p / (p + group_mean * (1. - p));
+
+    while (ret.files + ret.links < params.files) {
+        const size_t left = params.files - ret.files - ret.links;
+
+        if (left >= params.group_min && chance(rnd, group_chance)) {
+            const size_t count = std::min<size_t>(uniform(rnd, params.group_min, params.group_max), left);
+            const auto content = make_content(log_uniform_size(rnd, params));
+            sizes.push_back(content.size);
+
+            const auto first = make_path();
+            writer.write(first, content);
+            ++ret.files;
+            ret.bytes += content.size;
+
+            for (size_t i = 1; i < count; ++i) {
+                const auto file_path = make_path();
+                if (chance(rnd, params.hardlink_ratio)) {
+                    fs::create_hard_link(first, file_path);
+                    ++ret.links;
+                    continue;
+                }
+                writer.write(file_path, content);
+                ++ret.files;
+                ret.bytes += content.size;
+            }
+
+            ++ret.groups;
+            ret.duplicates += count;
+            continue;
+        }
+
+        const auto size = !sizes.empty() && chance(rnd, params.same_size_ratio) ?
+            sizes[rnd() % sizes.size()] : log_uniform_size(rnd, params);
+        const auto content = make_content(size);
+        sizes.push_back(size);
+
+        writer.write(make_path(), content);
+        ++ret.files;
+        ret.bytes += size;
+    }
+
+    return ret;
+}
+
+CorpusStats replay_shape(std::istream& trace, const fs::path& root) {
+    CorpusStats ret;
+    CorpusParams params;
+    params.shared_prefix = 0; // divergence is defined by trace only
+    Writer writer { params };
+
+    std::string line;
+    if (!std::getline(trace, line) || line != "bayan-shape 1")
+        throw std::runtime_error { "unknown format of shape trace" };
+
+    std::vector<fs::path> dirs;
+    uintmax_t file_size = 0, level_size = 0;
+    std::map<std::string, size_t> nodes; ///< number of files of nodes of current bucket
+
+    const auto count_groups = [&] {
+        for (const auto& n : nodes) {
+            if (n.second < 2)
+                continue;
+            ++ret.groups;
+            ret.duplicates += n.second;
+        }
+        nodes.clear();
+    };
+
+    while (std::getline(trace, line)) {
+        std::istringstream is { line };
+        char type;
+        is >> type;
+        if (type == 'd') {
+            size_t id;
+            std::string parent;
+            is >> id >> parent;
+            if (!is || id != dirs.size())
+                throw std::runtime_error { "malformed directory of shape trace: " + line };
+            dirs.push_back(parent == "-" ?
+                root / ("r" + std::to_string(id)) : dirs.at(std::stoul(parent)) / ("d" + std::to_string(id)));
+            fs::create_directories(dirs.back());
+        } else if (type == 'b') {
+            count_groups();
+            is >> file_size >> level_size;
+            if (!is)
+                throw std::runtime_error { "malformed bucket of shape trace: " + line };
+            level_size = level_size != 0 ? level_size : std::max<uintmax_t>(file_size, 1);
+        } else if (type == 'f') {
+            size_t dir;
+            std::string path;
+            is >> dir >> path;
+            if (!is)
+                throw std::runtime_error { "malformed file of shape trace: " + line };
+            ++nodes[path];
+
+            std::vector<std::pair<uint64_t, uint64_t>> runs;
+            if (path != "-") {
+                std::istringstream ps { path };
+                for (std::string run; std::getline(ps, run, '.'); ) {
+                    const auto star = run.find('*');
+                    runs.emplace_back(std::stoull(run.substr(0, star)),
+                                      star == std::string::npos ? 1 : std::stoull(run.substr(star + 1)));
+                }
+            }
+
+            writer.write(dirs.at(dir) / ("f" + std::to_string(ret.files)), file_size, level_size, runs);
+            ++ret.files;
+            ret.bytes += file_size;
+        }
+    }
+    count_groups();
+
+    return ret;
+}
+
+size_t evict_corpus(const fs::path& root) {
+    size_t ret = 0;
+    for (fs::recursive_directory_iterator it { root }, end; it != end; ++it) {
+        if (!fs::is_regular_file(it->symlink_status()))
+            continue;
+
+        int fd = open(it->path().c_str(), O_RDONLY);
+        if (fd == -1)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        ++ret;
+    }
+    return ret;
+}
+
+std::ostream& operator<< (std::ostream& os, const CorpusStats& stats) {
+    return os << "files " << stats.files
+              << ", hard links " << stats.links
+              << ", groups " << stats.groups
+              << ", duplicates " << stats.duplicates
+              << ", bytes " << stats.bytes;
+}
+
+} // namespace griha
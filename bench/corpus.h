@@ -0,0 +1,62 @@
+/// @file   corpus.h
+/// @brief  This file contains declaration of generator of synthetic directory corpora
+///         reproducible from seed.
+/// @author griha
+
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+
+#include <boost/filesystem/path.hpp>
+
+namespace griha {
+
+/// @brief Parameters of corpus, the same parameters and seed give the same corpus
+struct CorpusParams {
+    uint64_t seed = 1;
+    size_t files = 1000;
+    uintmax_t min_size = 1;            ///< sizes of files are distributed log-uniformly
+    uintmax_t max_size = 1024 * 1024;
+    double duplicate_ratio = 0.3;      ///< share of files which have duplicates
+    size_t group_min = 2;              ///< minimum number of files of group of duplicates
+    size_t group_max = 4;              ///< maximum number of files of group of duplicates
+    double same_size_ratio = 0.3;      ///< share of unique files having size of other file
+    uintmax_t shared_prefix = 0;       ///< number of leading bytes shared by files of the same size
+    size_t depth = 3;                  ///< maximum depth of directories
+    size_t fanout = 8;                 ///< number of sub-directories of directory
+    double sparse_ratio = 0.;          ///< share of files consisting of holes except a few blocks
+    double zero_ratio = 0.;            ///< share of files filled by zeros, ones of the same size are duplicates too
+    double hardlink_ratio = 0.;        ///< share of duplicates created as hard links
+};
+
+/// @brief Summary of generated corpus
+struct CorpusStats {
+    size_t files = 0;
+    size_t links = 0;
+    size_t groups = 0;                 ///< number of groups of duplicates
+    size_t duplicates = 0;             ///< number of files in groups of duplicates
+    uintmax_t bytes = 0;               ///< apparent size of files, links are counted once
+};
+
+/// @brief Generates corpus in directory
+/// @details Content is produced by counter based generator, so it doesn't depend on
+///          standard library implementation
+/// @param root Directory to be populated, it's created if doesn't exist
+CorpusStats generate_corpus(const boost::filesystem::path& root, const CorpusParams& params);
+
+/// @brief Generates corpus shaped as scanning recorded by @c SearchEngine::record_shape
+/// @details Directories and sizes of files are reproduced, content of files is crafted
+///          so that files of the same size match and diverge at the same levels
+/// @param trace Shape trace
+/// @param root Directory to be populated, it's created if doesn't exist
+CorpusStats replay_shape(std::istream& trace, const boost::filesystem::path& root);
+
+/// @brief Drops pages of files of directory from page cache for cold-cache runs
+/// @details Dirty pages are written back before, so they can be dropped
+/// @return Number of files evicted
+size_t evict_corpus(const boost::filesystem::path& root);
+
+std::ostream& operator<< (std::ostream& os, const CorpusStats& stats);
+
+} // namespace griha
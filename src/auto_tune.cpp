@@ -0,0 +1,296 @@
+/// @file   auto_tune.cpp
+/// @brief  This file contains definition of startup probe choosing parameters of comparing.
+/// @author griha
+
+#include "auto_tune.h"
+#include "block_device.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <boost/container/map.hpp>
+#include <boost/align/aligned_allocator.hpp>
+
+#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
+#include <cryptopp/md5.h>
+#include <cryptopp/sha.h>
+
+namespace fs = boost::filesystem;
+namespace cont = boost::container;
+
+namespace griha {
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+/// @name Limits of sampling of files to be scanned
+/// @{
+constexpr auto c_sample_time = std::chrono::milliseconds { 500 };
+constexpr size_t c_sample_files = 256;
+constexpr uintmax_t c_sample_file_min_size = 64 * 1024;
+/// @}
+
+/// @brief Sizes of reads latency and bandwidth of device are estimated by
+constexpr size_t c_probe_sizes[] = { 4096, 16384, 65536, 262144, 1048576 };
+constexpr size_t c_probe_reads = 16; ///< number of reads of each size
+
+/// @brief Duration of measurement of throughput of device for one number of workers
+constexpr auto c_concurrency_slice = std::chrono::milliseconds { 200 };
+constexpr size_t c_max_concurrency = 64;
+constexpr double c_concurrency_gain = 1.1; ///< minimum growth of throughput by doubling of workers
+
+constexpr auto c_hash_time = std::chrono::milliseconds { 100 };
+
+constexpr size_t c_min_block_size = 1024;
+constexpr size_t c_max_block_size = 1024 * 1024;
+
+constexpr size_t c_alignment = 4096;
+
+using buffer_type = std::vector<char, boost::alignment::aligned_allocator<char, c_alignment>>;
+
+struct Sample {
+    int fd;
+    uintmax_t size;
+};
+
+struct Device {
+    bool rotational;
+    bool direct = true; ///< all samples are opened with @c O_DIRECT flag
+    std::vector<Sample> files;
+};
+using devices_type = cont::map<dev_t, Device>;
+
+/// @brief Takes files to be scanned until enough files are found or sampling time is over
+void sample(const SearchEngine::paths_type& paths, bool recursive, devices_type& devices) {
+    const auto deadline = clock_type::now() + c_sample_time;
+    size_t count = 0;
+
+    auto take = [&] (const fs::path& p) {
+        struct stat st;
+        if (stat(p.c_str(), &st) == -1 || !S_ISREG(st.st_mode) ||
+            static_cast<uintmax_t>(st.st_size) < c_sample_file_min_size)
+            return;
+
+        bool direct = true;
+        int fd = open(p.c_str(), O_RDONLY | O_DIRECT);
+        if (fd == -1 && errno == EINVAL) {
+            direct = false;
+            fd = open(p.c_str(), O_RDONLY);
+        }
+        if (fd == -1)
+            return;
+
+        auto it = devices.find(st.st_dev);
+        if (it == devices.end())
+            it = devices.emplace(st.st_dev, Device { is_rotational(st.st_dev), true, {} }).first;
+        it->second.direct = it->second.direct && direct;
+        it->second.files.push_back(Sample { fd, static_cast<uintmax_t>(st.st_size) });
+        ++count;
+    };
+
+    // paths and entries which can't be stat'ed aren't sampled, scanning skips them too
+    std::vector<fs::path> directories;
+    for (const auto& p : paths) {
+        boost::system::error_code ec;
+        const auto status = fs::status(p, ec);
+        if (ec)
+            continue;
+        if (fs::is_directory(status))
+            directories.push_back(p);
+        else
+            take(p);
+    }
+
+    while (!directories.empty() && count < c_sample_files && clock_type::now() < deadline) {
+        const auto dir = std::move(directories.back());
+        directories.pop_back();
+
+        boost::system::error_code ec;
+        for (fs::directory_iterator it { dir, ec }, end; !ec && it != end && count < c_sample_files;
+             it.increment(ec)) {
+            boost::system::error_code entry_ec;
+            const auto status = it->symlink_status(entry_ec);
+            if (entry_ec)
+                continue;
+            if (fs::is_directory(status)) {
+                if (recursive)
+                    directories.push_back(it->path());
+                continue;
+            }
+            take(it->path());
+        }
+    }
+}
+
+/// @brief Reads block of size at random aligned offset of random file fitting it
+/// @return @c false if there is no file to fit block
+bool read_random(const Device& d, size_t size, buffer_type& buffer, std::mt19937& rnd) {
+    for (size_t attempt = 0; attempt < d.files.size(); ++attempt) {
+        const auto& f = d.files[rnd() % d.files.size()];
+        if (f.size < size)
+            continue;
+
+        const off_t offset = (rnd() % ((f.size - size) / c_alignment + 1)) * c_alignment;
+        return pread(f.fd, buffer.data(), size, offset) > 0;
+    }
+    return false;
+}
+
+/// @return Median duration in seconds of reads of size, negative value if no file fits it
+double read_latency(const Device& d, size_t size, buffer_type& buffer, std::mt19937& rnd) {
+    std::vector<double> durations;
+    for (size_t i = 0; i < c_probe_reads; ++i) {
+        const auto start = clock_type::now();
+        if (!read_random(d, size, buffer, rnd))
+            return -1.;
+        durations.push_back(std::chrono::duration<double> { clock_type::now() - start }.count());
+    }
+
+    std::nth_element(durations.begin(), durations.begin() + durations.size() / 2, durations.end());
+    return durations[durations.size() / 2];
+}
+
+/// @return Number of bytes read per second by workers reading blocks simultaneously
+double read_throughput(const Device& d, size_t block_size, size_t workers) {
+    std::atomic<bool> stop { false };
+    std::atomic<uintmax_t> bytes { 0 };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i)
+        threads.emplace_back([&d, &stop, &bytes, block_size, i] {
+            std::mt19937 rnd { static_cast<std::mt19937::result_type>(i) };
+            buffer_type buffer(block_size);
+            while (!stop && read_random(d, block_size, buffer, rnd))
+                bytes += block_size;
+        });
+
+    const auto start = clock_type::now();
+    std::this_thread::sleep_for(c_concurrency_slice);
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+
+    return bytes / std::chrono::duration<double> { clock_type::now() - start }.count();
+}
+
+/// @return Number of bytes hashed per second by single thread
+double hash_throughput(hash_algo algo) {
+    CryptoPP::Weak::MD5 md5;
+    CryptoPP::SHA256 sha256;
+    CryptoPP::HashTransformation& hash = algo == hash_algo::md5 ?
+            static_cast<CryptoPP::HashTransformation&>(md5) : sha256;
+
+    std::vector<uint8_t> data(c_max_block_size, 0x5a);
+    std::vector<uint8_t> digest(hash.DigestSize());
+
+    uintmax_t bytes = 0;
+    const auto start = clock_type::now();
+    do {
+        hash.Update(data.data(), data.size());
+        hash.Final(digest.data());
+        bytes += data.size();
+    } while (clock_type::now() - start < c_hash_time);
+
+    return bytes / std::chrono::duration<double> { clock_type::now() - start }.count();
+}
+
+size_t round_block_size(double size) {
+    size_t ret = c_min_block_size;
+    while (ret < size && ret < c_max_block_size)
+        ret *= 2;
+    return ret;
+}
+
+} // unnamed namespace
+
+Tuning auto_tune(const SearchEngine::paths_type& paths, bool recursive, hash_algo algo, std::ostream& log) {
+    Tuning ret;
+
+    devices_type devices;
+    sample(paths, recursive, devices);
+
+    const double hash_rate = hash_throughput(algo);
+    ret.hash_rate = hash_rate;
+
+    std::mt19937 rnd;
+    buffer_type buffer(c_max_block_size);
+    for (const auto& dev : devices) {
+        const auto& d = dev.second;
+
+        // duration of read is approximated by latency + size / bandwidth
+        std::vector<std::pair<double, double>> points;
+        for (auto size : c_probe_sizes) {
+            const double t = read_latency(d, size, buffer, rnd);
+            if (t >= 0.)
+                points.emplace_back(static_cast<double>(size), t);
+        }
+        if (points.size() < 2)
+            continue;
+
+        double sx = 0., sy = 0., sxx = 0., sxy = 0.;
+        for (const auto& p : points) {
+            sx += p.first;
+            sy += p.second;
+            sxx += p.first * p.first;
+            sxy += p.first * p.second;
+        }
+        const double n = points.size();
+        const double slope = std::max((n * sxy - sx * sy) / (n * sxx - sx * sx), 1e-12);
+        const double latency = std::max((sy - slope * sx) / n, 0.);
+
+        // block is transferred and hashed as long as it's waited for
+        const size_t block_size = round_block_size(latency / (slope + 1. / hash_rate));
+
+        // reads of files opened with O_DIRECT flag fail unless they're aligned
+        const size_t probe_size = d.direct ? std::max(block_size, c_alignment) : block_size;
+
+        size_t workers = 1;
+        double best = read_throughput(d, probe_size, workers);
+        if (best <= 0.) {
+            log << "auto-tune: device " << major(dev.first) << ':' << minor(dev.first)
+                << " can't be read by blocks of " << probe_size << " bytes, defaults are kept" << std::endl;
+            continue;
+        }
+        for (size_t n = 2; n <= c_max_concurrency; n *= 2) {
+            const double t = read_throughput(d, probe_size, n);
+            if (t < best * c_concurrency_gain)
+                break;
+            best = t;
+            workers = n;
+        }
+
+        log << "auto-tune: device " << major(dev.first) << ':' << minor(dev.first)
+            << (d.rotational ? " (hdd)" : " (ssd)")
+            << ", latency " << static_cast<uintmax_t>(latency * 1e6) << " us"
+            << ", bandwidth " << static_cast<uintmax_t>(1. / slope / 1e6) << " MB/s"
+            << ", hash " << static_cast<uintmax_t>(hash_rate / 1e6) << " MB/s"
+            << ", block size " << block_size << ", workers " << workers
+            << (d.direct ? "" : ", page cache isn't by-passed") << std::endl;
+
+        ret.devices.push_back(Tuning::Device { dev.first, latency, 1. / slope, workers });
+        ret.block_size = std::max(ret.block_size, block_size);
+        auto& concurrency = d.rotational ? ret.hdd_concurrency : ret.ssd_concurrency;
+        concurrency = std::max(concurrency, workers);
+    }
+
+    for (const auto& dev : devices) {
+        for (const auto& f : dev.second.files)
+            close(f.fd);
+    }
+
+    return ret;
+}
+
+} // namespace griha
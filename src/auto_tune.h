@@ -0,0 +1,46 @@
+/// @file   auto_tune.h
+/// @brief  This file contains declaration of startup probe choosing parameters of comparing
+///         of files by measurements of devices files reside on and of hash function.
+/// @author griha
+
+#pragma once
+
+#include <iosfwd>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "search_engine.h"
+
+namespace griha {
+
+/// @brief Parameters of comparing chosen by probe, @c 0 means value isn't chosen
+struct Tuning {
+    /// @brief Measurements of device
+    struct Device {
+        dev_t dev;
+        double latency;   ///< seconds
+        double bandwidth; ///< bytes per second
+        size_t workers;   ///< number of readers chosen for device
+    };
+
+    size_t block_size = 0;
+    size_t hdd_concurrency = 0; ///< chosen if files reside on rotational device
+    size_t ssd_concurrency = 0; ///< chosen if files reside on non-rotational device
+    double hash_rate = 0.;      ///< bytes hashed per second by single thread
+    std::vector<Device> devices;
+};
+
+/// @brief Probes devices files to be scanned reside on for a few seconds
+/// @details Sample of files is taken from paths to be scanned. Latency and bandwidth
+///          of reading of each device are estimated by reads of different sizes
+///          by-passing page cache. Block size is chosen to make latency of reading
+///          of block equal to time of its transfer and hashing. Number of workers
+///          is the least one reaching the most of bandwidth of device.
+/// @param paths Paths to be scanned
+/// @param recursive Whether paths are scanned recursively
+/// @param algo Hash algorithm to be measured
+/// @param log Stream measurements are logged to
+Tuning auto_tune(const SearchEngine::paths_type& paths, bool recursive, hash_algo algo, std::ostream& log);
+
+} // namespace griha
@@ -0,0 +1,32 @@
+/// @file   block_device.cpp
+/// @brief  This file contains definition of helpers to query properties of block devices.
+/// @author griha
+
+#include "block_device.h"
+
+#include <fstream>
+#include <string>
+
+#include <sys/sysmacros.h>
+
+#include <boost/filesystem/path.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+bool is_rotational(dev_t dev) {
+    const auto device_path = fs::path { "/sys/dev/block" } /
+            (std::to_string(major(dev)) + ':' + std::to_string(minor(dev)));
+
+    // partitions have no queue attributes, they are taken from parent device
+    for (const auto& p : { device_path / "queue/rotational", device_path / "../queue/rotational" }) {
+        std::ifstream is { p.string() };
+        int value;
+        if (is >> value)
+            return value != 0;
+    }
+    return false;
+}
+
+} // namespace griha
@@ -0,0 +1,17 @@
+/// @file   block_device.h
+/// @brief  This file contains declaration of helpers to query properties of block devices.
+/// @author griha
+
+#pragma once
+
+#include <sys/types.h>
+
+namespace griha {
+
+/// @brief Checks whether block device is rotational one (HDD)
+/// @param dev Identifier of device as it's returned by @c stat in @c st_dev field
+/// @return Value of @c queue/rotational attribute of device or its parent device if
+///         @c dev identifies partition. @c false if device isn't a block one.
+bool is_rotational(dev_t dev);
+
+} // namespace griha
@@ -0,0 +1,56 @@
+/// @file   block_hasher.cpp
+/// @brief  This file contains definition of BlockHasher class.
+/// @author griha
+
+#include "block_hasher.h"
+
+#include <stdexcept>
+
+#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
+#include <cryptopp/md5.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/filters.h>
+#include <cryptopp/base64.h>
+
+namespace griha {
+
+namespace {
+
+CryptoPP::HashTransformation* make_hash(hash_algo algo) {
+    switch (algo) {
+    case hash_algo::md5:
+        return new CryptoPP::Weak::MD5 {};
+    case hash_algo::sha256:
+        return new CryptoPP::SHA256 {};
+    }
+    throw std::invalid_argument { "unknown hash agorithm" };
+}
+
+} // unnamed namespace
+
+BlockHasher::BlockHasher(hash_algo algo)
+    : hash_(make_hash(algo))
+    , hash_filter_(new CryptoPP::HashFilter(*hash_,
+          new CryptoPP::Base64Encoder(new CryptoPP::StringSink(sink_), false)))
+    , digest_filter_(new CryptoPP::Base64Encoder(new CryptoPP::StringSink(sink_), false)) {}
+
+BlockHasher::~BlockHasher() = default;
+
+const std::string& BlockHasher::hash(const char* data, size_t size) {
+    sink_.clear(); // actually this call never reduces the capacity of string
+    hash_filter_->PutMessageEnd(reinterpret_cast<const uint8_t*>(data), size);
+    return sink_;
+}
+
+const std::string& BlockHasher::encode(const std::string& digest) {
+    sink_.clear();
+    digest_filter_->PutMessageEnd(reinterpret_cast<const uint8_t*>(digest.data()), digest.size());
+    return sink_;
+}
+
+const std::string& BlockHasher::assign(const char* data, size_t size) {
+    sink_.assign(data, size);
+    return sink_;
+}
+
+} // namespace griha
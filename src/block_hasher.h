@@ -0,0 +1,53 @@
+/// @file   block_hasher.h
+/// @brief  This file contains declaration of BlockHasher class produces keys of blocks
+///         of files in trees of size buckets.
+/// @author griha
+
+#pragma once
+
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "search_engine.h"
+
+namespace CryptoPP {
+class HashTransformation;
+class HashFilter;
+class Base64Encoder;
+} // namespace CryptoPP
+
+namespace griha {
+
+class BlockHasher {
+public:
+    explicit BlockHasher(hash_algo algo);
+
+    ~BlockHasher();
+
+    BlockHasher(const BlockHasher&) = delete;
+    BlockHasher& operator= (const BlockHasher&) = delete;
+
+    /// @brief Performs hash function on block
+    /// @return Digest value in base64 format
+    /// @note Returns constant reference on internal buffer valid until next call
+    const std::string& hash(const char* data, size_t size);
+
+    /// @brief Encodes raw digest produced elsewhere, e.g. by @c KernelHash
+    /// @return Digest value in base64 format
+    /// @note Returns constant reference on internal buffer valid until next call
+    const std::string& encode(const std::string& digest);
+
+    /// @brief Uses block as key as is
+    /// @note Returns constant reference on internal buffer valid until next call
+    const std::string& assign(const char* data, size_t size);
+
+private:
+    /// @note order of these fields initialization is important
+    boost::scoped_ptr<CryptoPP::HashTransformation> hash_;
+    std::string sink_;
+    boost::scoped_ptr<CryptoPP::HashFilter> hash_filter_;
+    boost::scoped_ptr<CryptoPP::Base64Encoder> digest_filter_;
+};
+
+} // namespace griha
@@ -0,0 +1,124 @@
+/// @file   block_source.cpp
+/// @brief  This file contains definition of implementations of BlockSource interface.
+/// @author griha
+
+#include "block_source.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+namespace {
+
+/// @brief Opens file for reading, @c O_DIRECT flag is dropped if filesystem doesn't support it
+int open_file(const fs::path& file_path, io_mode io) {
+    int fd = -1;
+    if (io == io_mode::direct) {
+        fd = ::open(file_path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd != -1 || errno != EINVAL)
+            return fd;
+    }
+
+    fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd != -1 && io == io_mode::fadvise)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+void close_file(int fd, io_mode io) {
+    if (io == io_mode::fadvise)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+/// @brief Reads blocks by positional reads, so no position of file is kept
+class PreadSource : public BlockSource {
+public:
+    explicit PreadSource(io_mode io) : io_(io) {}
+
+    int open(const fs::path& file_path) override {
+        return open_file(file_path, io_);
+    }
+
+    void close(int fd) override {
+        close_file(fd, io_);
+    }
+
+    size_t read(int fd, off_t offset, char* data, size_t size) override {
+        size_t ret = 0;
+        for (ssize_t n; ret < size; ret += n) {
+            n = pread(fd, data + ret, size - ret, offset + ret);
+            if (n <= 0)
+                break; // end of file is reached, file may be truncated while scanning
+        }
+        return ret;
+    }
+
+private:
+    const io_mode io_;
+};
+
+/// @brief Reads blocks by unbuffered stdio streams, stream is seeked unless block
+///        follows the previous one
+class StdioSource : public BlockSource {
+public:
+    explicit StdioSource(io_mode io) : io_(io) {}
+
+    int open(const fs::path& file_path) override {
+        const int fd = open_file(file_path, io_);
+        if (fd == -1)
+            return -1;
+
+        FILE* stream = fdopen(fd, "r");
+        if (stream == nullptr) {
+            close_file(fd, io_);
+            return -1;
+        }
+        setbuf(stream, nullptr);
+
+        if (streams_.size() <= static_cast<size_t>(fd))
+            streams_.resize(fd + 1, nullptr);
+        streams_[fd] = stream;
+        return fd;
+    }
+
+    void close(int fd) override {
+        if (io_ == io_mode::fadvise)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        fclose(streams_[fd]);
+        streams_[fd] = nullptr;
+    }
+
+    size_t read(int fd, off_t offset, char* data, size_t size) override {
+        FILE* stream = streams_[fd];
+        if (ftello(stream) != offset && fseeko(stream, offset, SEEK_SET) != 0)
+            return 0;
+        return fread(data, sizeof(char), size, stream);
+    }
+
+private:
+    const io_mode io_;
+    std::vector<FILE*> streams_; ///< open streams by their descriptors
+};
+
+} // unnamed namespace
+
+std::unique_ptr<BlockSource> make_block_source(reader_mode reader, io_mode io) {
+    switch (reader) {
+    case reader_mode::pread:
+        return std::unique_ptr<BlockSource> { new PreadSource { io } };
+    case reader_mode::stdio:
+        return std::unique_ptr<BlockSource> { new StdioSource { io } };
+    }
+    throw std::invalid_argument { "unknown reader mode" };
+}
+
+} // namespace griha
@@ -0,0 +1,44 @@
+/// @file   block_source.h
+/// @brief  This file contains declaration of BlockSource interface reading content of files
+///         compared by workers and of factory of its implementations.
+/// @author griha
+
+#pragma once
+
+#include <memory>
+
+#include <sys/types.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include "search_engine.h"
+
+namespace griha {
+
+/// @brief Source of blocks of files being compared
+/// @details File is identified by its descriptor, so it can be read by other readers
+///          of descriptor too, e.g. by kernel crypto API or by hashing helpers
+class BlockSource {
+public:
+    virtual ~BlockSource() = default;
+
+    /// @brief Opens file for reading according to I/O mode
+    /// @return Descriptor of file, -1 if file can't be opened, @c errno is set then
+    virtual int open(const boost::filesystem::path& file_path) = 0;
+
+    virtual void close(int fd) = 0;
+
+    /// @brief Reads block of file
+    /// @param fd Descriptor returned by @c open
+    /// @param offset Offset of block
+    /// @param data Buffer of @c size bytes at least
+    /// @return Number of bytes read, it's less than @c size at end of file or on error
+    virtual size_t read(int fd, off_t offset, char* data, size_t size) = 0;
+};
+
+/// @brief Creates block source of reader mode
+/// @note Source of @c reader_mode::pread has no state of files and can be shared by threads,
+///       source of @c reader_mode::stdio has to be owned by one thread
+std::unique_ptr<BlockSource> make_block_source(reader_mode reader, io_mode io);
+
+} // namespace griha
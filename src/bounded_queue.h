@@ -0,0 +1,149 @@
+/// @file   bounded_queue.h
+/// @brief  This file contains declaration and definition of BoundedQueue class connects
+///         stages of scanning pipeline.
+/// @author griha
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+#include <boost/lockfree/queue.hpp>
+
+namespace griha {
+
+/// @brief Lock-free multi-producer multi-consumer queue of fixed capacity
+/// @details Producer is blocked while queue is full, so slow stage holds back stages
+///          feeding it. Consumer is blocked while queue is empty until it is closed.
+///          Waiting is done by spinning with growing sleeps for about a millisecond,
+///          then waiting thread is parked on condition variable, so idle stages don't
+///          wake up until they have work. Lock is taken only if there are parked threads.
+/// @tparam T Type of value, it has to be trivially copyable, usually pointer
+template <typename T>
+class BoundedQueue {
+
+    struct Backoff {
+        unsigned count = 0;
+
+        /// @return @c false if backoff is exhausted and caller has to be parked
+        bool wait() {
+            if (count >= 16 + 10)
+                return false;
+            if (count < 16)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds { 1u << (count - 16) });
+            ++count;
+            return true;
+        }
+    };
+
+public:
+    /// @param capacity Maximum number of values in queue, it mustn't exceed 65534
+    explicit BoundedQueue(size_t capacity)
+        : queue_(capacity) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator= (const BoundedQueue&) = delete;
+
+    /// @brief Pushes value to queue, caller is blocked while queue is full
+    /// @return @c false if queue is cancelled, value isn't pushed in this case
+    bool push(const T& value) {
+        bool pushed = false;
+        for (Backoff b; !(pushed = queue_.bounded_push(value));) {
+            if (cancelled_)
+                return false;
+            if (!b.wait())
+                park(producers_, not_full_, [&] { return (pushed = queue_.bounded_push(value)) || cancelled_; });
+            if (pushed)
+                break;
+        }
+        notify(consumers_, not_empty_);
+        return true;
+    }
+
+    /// @brief Pushes value to queue if it isn't full
+    /// @return @c false if queue is full or cancelled, value isn't pushed in this case
+    bool try_push(const T& value) {
+        if (cancelled_ || !queue_.bounded_push(value))
+            return false;
+        notify(consumers_, not_empty_);
+        return true;
+    }
+
+    /// @brief Pops value from queue, caller is blocked while queue is empty and isn't closed
+    /// @return @c false if queue is closed and empty or it's cancelled
+    bool pop(T& value) {
+        for (Backoff b; !cancelled_;) {
+            if (queue_.pop(value)) {
+                notify(producers_, not_full_);
+                return true;
+            }
+            if (closed_)
+                return queue_.pop(value);
+            if (!b.wait())
+                park(consumers_, not_empty_, [this] { return !queue_.empty() || closed_ || cancelled_; });
+        }
+        return false;
+    }
+
+    /// @brief Notifies consumers that no more values will be pushed
+    void close() {
+        closed_ = true;
+        wake_all();
+    }
+
+    /// @brief Releases all blocked producers and consumers
+    /// @note Values left in queue can be got by @c consume_all
+    void cancel() {
+        cancelled_ = true;
+        wake_all();
+    }
+
+    template <typename Func>
+    void consume_all(Func&& fn) { queue_.consume_all(fn); }
+
+private:
+    /// @brief Parks caller until it's notified, @c ready predicate is checked under lock
+    ///        after caller is counted as parked, so notification can't be missed
+    template <typename Pred>
+    void park(std::atomic<unsigned>& parked, std::condition_variable& cv, Pred&& ready) {
+        std::unique_lock<std::mutex> lock { guard_ };
+        parked.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready())
+            cv.wait(lock);
+        parked.fetch_sub(1);
+    }
+
+    void notify(std::atomic<unsigned>& parked, std::condition_variable& cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard<std::mutex> lock { guard_ };
+        cv.notify_one();
+    }
+
+    void wake_all() {
+        std::lock_guard<std::mutex> lock { guard_ };
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    boost::lockfree::queue<T, boost::lockfree::fixed_sized<true>> queue_;
+    std::atomic<bool> closed_ { false };
+    std::atomic<bool> cancelled_ { false };
+
+    std::mutex guard_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::atomic<unsigned> consumers_ { 0 }; ///< number of parked consumers
+    std::atomic<unsigned> producers_ { 0 }; ///< number of parked producers
+};
+
+} // namespace griha
@@ -0,0 +1,97 @@
+/// @file   file_extents.cpp
+/// @brief  This file contains definition of helpers to query physical layout of files.
+/// @author griha
+
+#include "file_extents.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#   include <linux/fs.h>
+#   include <linux/fiemap.h>
+#endif
+
+#include <boost/scope_exit.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+namespace {
+
+template <typename T>
+void append(std::string& s, const T& value) {
+    s.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+} // unnamed namespace
+
+#ifdef __linux__
+
+boost::optional<std::string> file_extents(const fs::path& file_path) {
+    constexpr uint32_t c_extents_count = 32;
+    constexpr uint32_t c_untrusted_flags =
+            FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED |
+            FIEMAP_EXTENT_DATA_ENCRYPTED | FIEMAP_EXTENT_NOT_ALIGNED |
+            FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL;
+
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return boost::none;
+    BOOST_SCOPE_EXIT(&fd) {
+        close(fd);
+    } BOOST_SCOPE_EXIT_END;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return boost::none;
+
+    union {
+        struct fiemap map;
+        char data[sizeof(struct fiemap) + c_extents_count * sizeof(struct fiemap_extent)];
+    } request;
+
+    // physical offsets are meaningful inside one filesystem only
+    std::string ret;
+    append(ret, st.st_dev);
+
+    for (uint64_t start = 0;;) {
+        std::memset(&request, 0, sizeof(request));
+        request.map.fm_start = start;
+        request.map.fm_length = FIEMAP_MAX_OFFSET - start;
+        request.map.fm_extent_count = c_extents_count;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == -1 || request.map.fm_mapped_extents == 0)
+            return boost::none;
+
+        for (uint32_t i = 0; i < request.map.fm_mapped_extents; ++i) {
+            const auto& e = request.map.fm_extents[i];
+            if ((e.fe_flags & c_untrusted_flags) != 0)
+                return boost::none;
+
+            append(ret, e.fe_logical);
+            append(ret, e.fe_physical);
+            append(ret, e.fe_length);
+
+            if ((e.fe_flags & FIEMAP_EXTENT_LAST) != 0)
+                return ret;
+
+            start = e.fe_logical + e.fe_length;
+        }
+    }
+}
+
+#else
+
+boost::optional<std::string> file_extents(const fs::path&) {
+    return boost::none;
+}
+
+#endif
+
+} // namespace griha
@@ -0,0 +1,22 @@
+/// @file   file_extents.h
+/// @brief  This file contains declaration of helpers to query physical layout of files.
+/// @author griha
+
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
+namespace griha {
+
+/// @brief Builds signature of physical extents occupied by file
+/// @param file_path Path to file to be queried
+/// @return Opaque signature which is equal for files sharing all their extents
+///         (reflinked copies or hard links) or nothing if layout of file can't be
+///         trusted, for example filesystem doesn't support @c FIEMAP or file has
+///         inline, encoded or not yet allocated extents
+boost::optional<std::string> file_extents(const boost::filesystem::path& file_path);
+
+} // namespace griha
@@ -0,0 +1,31 @@
+/// @file   heap_stats.cpp
+/// @brief  This file contains definition of counters of heap memory of search engine.
+/// @author griha
+
+#include "heap_stats.h"
+
+#include <array>
+
+namespace griha {
+
+HeapCounters& heap_counters(heap_category category) {
+    static std::array<HeapCounters, static_cast<size_t>(heap_category::count)> counters;
+    return counters[static_cast<size_t>(category)];
+}
+
+void reset_heap_counters() {
+    for (size_t i = 0; i < static_cast<size_t>(heap_category::count); ++i)
+        heap_counters(static_cast<heap_category>(i)).reset();
+}
+
+const char* heap_category_name(heap_category category) {
+    switch (category) {
+    case heap_category::nodes: return "nodes";
+    case heap_category::lists: return "lists";
+    case heap_category::buckets: return "buckets";
+    case heap_category::count: break;
+    }
+    return "unknown";
+}
+
+} // namespace griha
@@ -0,0 +1,88 @@
+/// @file   heap_stats.h
+/// @brief  This file contains declaration of CountingAllocator class accounting heap
+///         memory of containers of search engine by category.
+/// @author griha
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace griha {
+
+/// @brief Categories of heap memory held by containers of search engine
+enum class heap_category {
+    nodes,   ///< nodes of trees of size buckets
+    lists,   ///< elements of lists of files
+    buckets, ///< size buckets
+    count
+};
+
+/// @brief Counters of heap memory of category, they are shared by all engines of process
+struct HeapCounters {
+    std::atomic<uintmax_t> bytes { 0 };       ///< allocated now
+    std::atomic<uintmax_t> peak { 0 };        ///< maximum of allocated since reset
+    std::atomic<uintmax_t> blocks { 0 };      ///< number of blocks allocated now
+    std::atomic<uintmax_t> allocations { 0 }; ///< number of allocations since reset
+
+    void allocate(size_t size) {
+        const auto current = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        for (auto p = peak.load(std::memory_order_relaxed);
+             current > p && !peak.compare_exchange_weak(p, current, std::memory_order_relaxed);)
+            ;
+        blocks.fetch_add(1, std::memory_order_relaxed);
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void deallocate(size_t size) {
+        bytes.fetch_sub(size, std::memory_order_relaxed);
+        blocks.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// @brief Starts new period of measurement, memory allocated now is kept
+    void reset() {
+        peak = bytes.load();
+        allocations = 0;
+    }
+};
+
+HeapCounters& heap_counters(heap_category category);
+
+/// @brief Resets counters of all categories
+void reset_heap_counters();
+
+const char* heap_category_name(heap_category category);
+
+/// @brief Stateless allocator accounting memory it allocates in counters of category
+template <typename T, heap_category Category>
+class CountingAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = CountingAllocator<U, Category>;
+    };
+
+    CountingAllocator() noexcept = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U, Category>&) noexcept {}
+
+    T* allocate(size_t n) {
+        auto ret = std::allocator<T> {}.allocate(n);
+        heap_counters(Category).allocate(n * sizeof(T));
+        return ret;
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        heap_counters(Category).deallocate(n * sizeof(T));
+        std::allocator<T> {}.deallocate(p, n);
+    }
+
+    friend bool operator== (const CountingAllocator&, const CountingAllocator&) noexcept { return true; }
+    friend bool operator!= (const CountingAllocator&, const CountingAllocator&) noexcept { return false; }
+};
+
+} // namespace griha
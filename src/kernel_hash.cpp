@@ -0,0 +1,140 @@
+/// @file   kernel_hash.cpp
+/// @brief  This file contains definition of KernelHash class.
+/// @author griha
+
+#include "kernel_hash.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#   include <linux/if_alg.h>
+#endif
+
+namespace griha {
+
+namespace {
+
+constexpr size_t c_pipe_chunk_size = 64 * 1024;
+
+const char* kernel_name(hash_algo algo) {
+    switch (algo) {
+    case hash_algo::md5: return "md5";
+    case hash_algo::sha256: return "sha256";
+    }
+    return nullptr;
+}
+
+size_t digest_size(hash_algo algo) {
+    switch (algo) {
+    case hash_algo::md5: return 16;
+    case hash_algo::sha256: return 32;
+    }
+    return 0;
+}
+
+} // unnamed namespace
+
+#ifdef __linux__
+
+KernelHash::KernelHash(hash_algo algo)
+    : digest_size_(digest_size(algo)) {
+
+    tfm_ = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (tfm_ == -1)
+        return;
+
+    struct sockaddr_alg sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    std::strcpy(reinterpret_cast<char*>(sa.salg_type), "hash");
+    std::strcpy(reinterpret_cast<char*>(sa.salg_name), kernel_name(algo));
+
+    if (bind(tfm_, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) == -1)
+        return;
+
+    reset();
+}
+
+KernelHash::~KernelHash() {
+    for (auto fd : { op_, pipe_[0], pipe_[1], tfm_ })
+        if (fd != -1)
+            close(fd);
+}
+
+void KernelHash::reset() {
+    // operation socket and pipe may keep data of failed block, so they are recreated
+    for (auto fd : { op_, pipe_[0], pipe_[1] })
+        if (fd != -1)
+            close(fd);
+    op_ = pipe_[0] = pipe_[1] = -1;
+
+    if (pipe2(pipe_, O_CLOEXEC) == 0)
+        op_ = accept4(tfm_, nullptr, nullptr, SOCK_CLOEXEC);
+}
+
+ssize_t KernelHash::digest(int fd, off_t offset, size_t size, std::string& digest) {
+    static const char zeros[c_pipe_chunk_size] = {};
+
+    assert(valid() && size != 0);
+
+    size_t hashed = 0;
+    while (hashed < size) {
+        auto in = splice(fd, &offset, pipe_[1], nullptr,
+                         std::min(size - hashed, c_pipe_chunk_size), SPLICE_F_MOVE);
+        if (in == 0)
+            break; // end of file, rest of block is padded
+        if (in < 0) {
+            reset();
+            return -1;
+        }
+
+        // hash operation is finalized by the last part of block sent without 'more' flag
+        for (ssize_t out; in > 0; in -= out, hashed += out) {
+            const bool more = hashed + in < size;
+            out = splice(pipe_[0], nullptr, op_, nullptr, in, more ? SPLICE_F_MORE : 0);
+            if (out <= 0) {
+                reset();
+                return -1;
+            }
+        }
+    }
+
+    for (size_t padded = hashed; padded < size;) {
+        const auto n = std::min(size - padded, c_pipe_chunk_size);
+        padded += n;
+        if (send(op_, zeros, n, padded < size ? MSG_MORE : 0) != static_cast<ssize_t>(n)) {
+            reset();
+            return -1;
+        }
+    }
+
+    digest.resize(digest_size_);
+    if (read(op_, &digest[0], digest_size_) != static_cast<ssize_t>(digest_size_)) {
+        reset();
+        return -1;
+    }
+    return static_cast<ssize_t>(hashed);
+}
+
+#else
+
+KernelHash::KernelHash(hash_algo algo)
+    : digest_size_(digest_size(algo)) {}
+
+KernelHash::~KernelHash() = default;
+
+void KernelHash::reset() {}
+
+ssize_t KernelHash::digest(int, off_t, size_t, std::string&) {
+    return -1;
+}
+
+#endif
+
+} // namespace griha
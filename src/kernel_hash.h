@@ -0,0 +1,48 @@
+/// @file   kernel_hash.h
+/// @brief  This file contains declaration of KernelHash class provides hashing of file
+///         blocks by kernel crypto API without copying of file content to user space.
+/// @author griha
+
+#pragma once
+
+#include <string>
+
+#include <sys/types.h>
+
+#include "search_engine.h"
+
+namespace griha {
+
+class KernelHash {
+public:
+    /// @brief Opens @c AF_ALG hash socket for specified algorithm
+    /// @note Check @c valid method before use, kernel may not support @c AF_ALG sockets
+    explicit KernelHash(hash_algo algo);
+
+    ~KernelHash();
+
+    KernelHash(const KernelHash&) = delete;
+    KernelHash& operator= (const KernelHash&) = delete;
+
+    bool valid() const { return op_ != -1; }
+
+    /// @brief Hashes block of file padded by zeros
+    /// @param fd File descriptor to be hashed
+    /// @param offset Offset of block in file
+    /// @param size Size of block, if file ends earlier block is padded by zeros
+    /// @param[out] digest Raw digest value
+    /// @return Number of bytes of file hashed or -1 on failure
+    /// @note File pages are moved to kernel crypto driver by @c splice through pipe
+    ssize_t digest(int fd, off_t offset, size_t size, std::string& digest);
+
+private:
+    void reset();
+
+private:
+    int tfm_ = -1;
+    int op_ = -1;
+    int pipe_[2] = { -1, -1 };
+    size_t digest_size_;
+};
+
+} // namespace griha
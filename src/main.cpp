@@ -1,53 +1,40 @@
 #include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <clocale>
+#include <csignal>
 #include <string>
 #include <algorithm>
 #include <vector>
+#include <thread>
+
+#include <sys/sysmacros.h>
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
 #include <boost/tokenizer.hpp>
+#include <boost/optional.hpp>
 
 #include "search_engine.h"
+#include "options.h"
+#include "auto_tune.h"
+#include "perf_counters.h"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-using namespace std::string_literals;
-
 namespace griha {
 
-/// @name Converters of custom types have to be supported by @c boost::program_options
-/// @{
+namespace {
 
-inline std::ostream& operator<< (std::ostream& os, hash_algo hash) {
-    switch (hash) {
-    case hash_algo::md5: os << "md5"; break;
-    case hash_algo::sha256: os << "sha256"; break;
-    default:
-        throw po::invalid_option_value{ "expected: md5|sha256" };
-    }
-    return os;
-}
+/// @brief Counter of @c SIGHUP signals, limits of reading are reloaded when it's changed
+std::atomic<unsigned> g_reload_requests { 0 };
 
-inline std::istream& operator>> (std::istream& is, hash_algo& hash) {
-    std::string value;
-    is >> value;
-
-    if (value == "md5"s)
-        hash = hash_algo::md5;
-    else if (value == "sha256"s)
-        hash = hash_algo::sha256;
-    else
-        throw po::invalid_option_value{ "expected: md5|sha256" };
-    return is;
+void on_reload_signal(int) {
+    g_reload_requests.fetch_add(1, std::memory_order_relaxed);
 }
 
-/// @}
-
-namespace {
-
 /// @name Free functions to process command line options
 /// @{
 
@@ -71,6 +58,97 @@ auto create_rxpatters(const std::string& patterns) {
     return ret;
 }
 
+/// @brief Prints out estimated cost of comparing, time is projected by measurements of devices
+void print_estimate(std::ostream& os, const SearchEngine::Estimate& estimate, const Tuning& tuning,
+                    size_t hdd_concurrency, size_t ssd_concurrency) {
+    os << estimate.files << " files are found" << std::endl;
+    for (const auto& e : estimate.devices) {
+        os << "device " << major(e.dev) << ':' << minor(e.dev) << (e.rotational ? " (hdd)" : " (ssd)")
+           << ": " << e.files << " files of " << e.buckets << " sizes to be compared, "
+           << e.bytes << " bytes" << std::endl
+           << "\tto be read: " << e.min_read << " .. " << e.max_read << " bytes by "
+           << e.min_ops << " .. " << e.max_ops << " reads" << std::endl;
+
+        auto it = std::find_if(tuning.devices.begin(), tuning.devices.end(),
+                               [&e] (const Tuning::Device& d) { return d.dev == e.dev; });
+        if (it == tuning.devices.end())
+            continue;
+
+        // readers wait for device in parallel, hashing is done by them too
+        const size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+        size_t workers = e.rotational ? hdd_concurrency : ssd_concurrency;
+        if (workers == 0)
+            workers = cpus;
+        auto time = [&] (uintmax_t bytes, uintmax_t ops) {
+            return std::max((ops * it->latency + bytes / it->bandwidth) / workers,
+                            bytes / (tuning.hash_rate * std::min(workers, cpus)));
+        };
+        os << "\tprojected time: " << std::fixed << std::setprecision(1)
+           << time(e.min_read, e.min_ops) << " .. " << time(e.max_read, e.max_ops) << " s" << std::endl;
+    }
+}
+
+/// @brief Prints out heap memory held by engine by category
+void print_heap(std::ostream& os, const SearchEngine::Heap& heap) {
+    uintmax_t bytes = 0, peak = 0;
+    os << "heap usage of " << heap.files << " files:" << std::endl
+       << std::left << std::setw(10) << "category" << std::right
+       << std::setw(14) << "bytes" << std::setw(14) << "peak"
+       << std::setw(12) << "blocks" << std::setw(14) << "allocations" << std::endl;
+    for (const auto& c : heap.categories) {
+        os << std::left << std::setw(10) << c.name << std::right
+           << std::setw(14) << c.bytes << std::setw(14) << c.peak
+           << std::setw(12) << c.blocks << std::setw(14) << c.allocations << std::endl;
+        bytes += c.bytes;
+        peak += c.peak;
+    }
+    os << std::left << std::setw(10) << "total" << std::right
+       << std::setw(14) << bytes << std::setw(14) << peak << std::endl;
+    if (heap.files != 0)
+        os << bytes / heap.files << " bytes per file" << std::endl;
+}
+
+/// @brief Prints out hardware events counted by phases of scanning
+/// @param output Counters of printing out of results
+void print_perf(std::ostream& os, const SearchEngine::Report& report, const PerfCounters& output) {
+    if (report.phases.empty() || !output.valid()) {
+        os << "performance counters are not available, see /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        return;
+    }
+
+    auto phases = report.phases;
+    phases.push_back(SearchEngine::Report::Phase { "output", output.read() });
+
+    const double mb = report.bytes_read / (1024. * 1024.);
+    auto ratio = [&os] (uint64_t events, double base) -> std::ostream& {
+        if (base == 0.)
+            return os << std::setw(12) << '-';
+        return os << std::setw(12) << events / base;
+    };
+
+    os << "performance counters of " << report.files << " files, "
+       << report.bytes_read << " bytes hashed:" << std::endl
+       << std::left << std::setw(10) << "phase" << std::right
+       << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(8) << "IPC"
+       << std::setw(14) << "cache-misses" << std::setw(14) << "branch-misses"
+       << std::setw(12) << "cache/file" << std::setw(12) << "branch/file"
+       << std::setw(12) << "cache/MB" << std::setw(12) << "branch/MB" << std::endl;
+    for (const auto& ph : phases) {
+        const auto& v = ph.values;
+        os << std::left << std::setw(10) << ph.name << std::right << std::fixed << std::setprecision(2)
+           << std::setw(16) << v.cycles << std::setw(16) << v.instructions;
+        if (v.cycles != 0)
+            os << std::setw(8) << static_cast<double>(v.instructions) / v.cycles;
+        else
+            os << std::setw(8) << '-';
+        os << std::setw(14) << v.cache_misses << std::setw(14) << v.branch_misses;
+        ratio(v.cache_misses, report.files);
+        ratio(v.branch_misses, report.files);
+        ratio(v.cache_misses, mb);
+        ratio(v.branch_misses, mb) << std::endl;
+    }
+}
+
 /// @}
 
 } // unnamed namespace
@@ -79,33 +157,80 @@ auto create_rxpatters(const std::string& patterns) {
 int main(int argc, char* argv[]) {
     using namespace griha;
 
-    constexpr auto c_default_block_size = 1024;
-    constexpr auto c_default_file_min_size = 1;
-    constexpr auto c_default_hash_algo = griha::hash_algo::md5;
+    constexpr auto c_exit_incomplete = 2;
 
-    bool opt_help, recursive;
+    const SearchEngine::InitParams c_default;
+
+    bool opt_help, recursive, opt_auto_tune, opt_estimate, opt_stats;
     std::string patterns;
-    std::vector<fs::path> paths_scan, paths_exclude;
-    size_t file_min_size, block_size;
-    hash_algo halgo;
+    fs::path shape_file;
+    SearchEngine::InitParams params;
 
     // command line options
     po::options_description generic { "Options" };
     generic.add_options()
             ("help,h", po::bool_switch(&opt_help), "prints out this message")
-            ("exclude-path,E", po::value(&paths_exclude), "path to be excluded from scanning")
+            ("exclude-path,E", po::value(&params.paths_exclude), "path to be excluded from scanning")
             ("patterns,P", po::value(&patterns), "patterns of files to be scanned")
-            ("block-size,B", po::value(&block_size)->default_value(c_default_block_size),
+            ("block-size,B", po::value(&params.block_size)->default_value(c_default.block_size),
                              "block size in bytes")
-            ("min-size,S", po::value(&file_min_size)->default_value(c_default_file_min_size),
+            ("min-size,S", po::value(&params.file_min_size)->default_value(c_default.file_min_size),
                            "minimum file size to be scanned in bytes")
-            ("hash,H", po::value(&halgo)->default_value(c_default_hash_algo),
+            ("small-size,s", po::value(&params.small_file_size)->default_value(c_default.small_file_size),
+                             "maximum size in bytes of file to be compared as a whole")
+            ("large-size", po::value(&params.large_file_size)->default_value(c_default.large_file_size),
+                           "minimum size in bytes of file to be hashed by chunks in parallel, 0 - never")
+            ("hash,H", po::value(&params.algo)->default_value(c_default.algo),
                        "hash algorithm, md5, sha256")
+            ("kernel-hash", po::bool_switch(&params.kernel_hash),
+                            "hash blocks by kernel crypto API without copying to user space")
+            ("io", po::value(&params.io)->default_value(c_default.io),
+                   "I/O mode, buffered, fadvise, direct")
+            ("reader", po::value(&params.reader)->default_value(c_default.reader),
+                       "reader of blocks, pread, stdio")
+            ("schedule", po::value(&params.schedule)->default_value(c_default.schedule),
+                         "order of comparing of files of the same size, stream, savings, latency")
+            ("traversal-concurrency",
+                    po::value(&params.traversal_concurrency)->default_value(c_default.traversal_concurrency),
+                    "number of parallel directory enumerators and metadata readers")
+            ("hdd-concurrency", po::value(&params.hdd_concurrency)->default_value(c_default.hdd_concurrency),
+                                "number of parallel readers of rotational device")
+            ("ssd-concurrency", po::value(&params.ssd_concurrency)->default_value(c_default.ssd_concurrency),
+                                "number of parallel readers of non-rotational device, 0 - number of CPUs")
+            ("hash-concurrency", po::value(&params.hash_concurrency)->default_value(c_default.hash_concurrency),
+                                 "number of parts of chunk of large file hashed in parallel, 0 - number of CPUs")
+            ("max-read-rate", po::value(&params.max_read_rate)->default_value(c_default.max_read_rate),
+                              "maximum number of bytes read per second, 0 - unlimited")
+            ("max-iops", po::value(&params.max_iops)->default_value(c_default.max_iops),
+                         "maximum number of read operations per second, 0 - unlimited")
+            ("time-budget", po::value(&params.time_budget)->default_value(c_default.time_budget),
+                            "number of seconds scanning is stopped after, 0 - unlimited")
+            ("read-budget", po::value(&params.read_budget)->default_value(c_default.read_budget),
+                            "number of bytes scanning is stopped after reading of, 0 - unlimited")
+            ("throttle-file", po::value(&params.throttle_file),
+                              "file limits of reading are reloaded from on SIGHUP")
+            ("shared-extents", po::bool_switch(&params.detect_shared),
+                               "detect files sharing physical extents without reading them")
+            ("cached-first", po::bool_switch(&params.cached_first),
+                             "compare files residing in page cache first")
+            ("auto-tune", po::bool_switch(&opt_auto_tune),
+                          "choose block size and numbers of readers by probing devices, "
+                          "options set explicitly are kept")
+            ("estimate", po::bool_switch(&opt_estimate),
+                         "estimate cost of comparing by sizes of files without reading them, "
+                         "time is projected if --auto-tune is set")
+            ("stats", po::bool_switch(&opt_stats),
+                      "print out heap memory held by engine by category after scanning")
+            ("perf-counters", po::bool_switch(&params.perf_counters),
+                              "print out hardware events counted by phases of scanning: "
+                              "traversal, bucketing, hashing and output")
+            ("record-shape", po::value(&shape_file),
+                             "file anonymized shape of scanning is written to for benchmarking")
             ("recursive,r", po::bool_switch(&recursive), "scan recursively");
 
     // Next options allowed at command line, but isn't shown in help
     po::options_description hidden {};
-    hidden.add_options()("scan-path", po::value(&paths_scan));
+    hidden.add_options()("scan-path", po::value(&params.paths_scan));
     po::positional_options_description pos;
     pos.add("scan-path", -1);
 
@@ -127,27 +252,89 @@ int main(int argc, char* argv[]) {
         return EXIT_SUCCESS;
     }
 
-    if (paths_scan.empty())
-        paths_scan.push_back(fs::current_path());
+    if (params.paths_scan.empty())
+        params.paths_scan.push_back(fs::current_path());
 
-    SearchEngine::InitParams init_params = {
-        halgo,
-        block_size,
-        file_min_size,
-        std::move(paths_scan),
-        std::move(paths_exclude),
-        create_rxpatters(patterns)
-    };
-    SearchEngine sengine { std::move(init_params) };
+    Tuning tuning;
+    if (opt_auto_tune) {
+        tuning = auto_tune(params.paths_scan, recursive, params.algo, std::cerr);
+        if (tuning.block_size != 0 && opts["block-size"].defaulted())
+            params.block_size = tuning.block_size;
+        if (tuning.hdd_concurrency != 0 && opts["hdd-concurrency"].defaulted())
+            params.hdd_concurrency = tuning.hdd_concurrency;
+        if (tuning.ssd_concurrency != 0 && opts["ssd-concurrency"].defaulted())
+            params.ssd_concurrency = tuning.ssd_concurrency;
+
+        // chosen values are logged as options to be pinned
+        std::cerr << "auto-tune: -B " << params.block_size
+                  << " --hdd-concurrency " << params.hdd_concurrency
+                  << " --ssd-concurrency " << params.ssd_concurrency << std::endl;
+    }
+
+    if (!params.throttle_file.empty())
+        std::signal(SIGHUP, on_reload_signal);
+    params.reload_requests = &g_reload_requests;
+    params.rxpatterns = create_rxpatters(patterns);
+
+    SearchEngine sengine { params };
+
+    if (opt_estimate) {
+        print_estimate(std::cout, sengine.estimate(recursive), tuning,
+                       params.hdd_concurrency, params.ssd_concurrency);
+        return EXIT_SUCCESS;
+    }
 
     sengine.run(recursive);
 
+    if (opt_stats)
+        print_heap(std::cerr, sengine.heap());
+
+    if (!shape_file.empty()) {
+        std::ofstream os { shape_file.string() };
+        sengine.record_shape(os);
+        if (!os)
+            std::cerr << "failed to write shape to " << shape_file << std::endl;
+    }
+
+    boost::optional<PerfCounters> output_perf;
+    if (params.perf_counters)
+        output_perf.emplace();
+
     for (const auto& v : sengine) {
         v.visit([] (const fs::path& path) {
             std::cout << fs::absolute(path).lexically_normal().string() << std::endl;
         });
+        v.visit_shared([] (const fs::path& path) {
+            std::cout << fs::absolute(path).lexically_normal().string() << "\t[shared]" << std::endl;
+        });
         endl(std::cout);
     }
 
-    return EXIT_SUCCESS;
+    const auto& report = sengine.report();
+    if (output_perf)
+        print_perf(std::cerr, report, *output_perf);
+
+    if (report.skipped_files != 0 || report.skipped_directories != 0)
+        std::cerr << report.skipped_files << " files and " << report.skipped_directories
+                  << " directories are skipped because of errors, e.g. they are removed while scanning"
+                  << std::endl;
+    if (report.completed)
+        return EXIT_SUCCESS;
+
+    uintmax_t files = 0, bytes = 0;
+    for (const auto& b : report.unresolved) {
+        files += b.count;
+        bytes += b.file_size * b.count;
+    }
+
+    std::cerr << "budget is exhausted after reading of " << report.bytes_read << " bytes";
+    if (!report.traversed)
+        std::cerr << ", traversal isn't completed";
+    std::cerr << std::endl
+              << files << " files of " << report.unresolved.size() << " sizes (" << bytes
+              << " bytes) remain unresolved" << std::endl;
+    for (const auto& b : report.unresolved)
+        std::cerr << '\t' << b.count << " files of " << b.file_size << " bytes" << std::endl;
+
+    return c_exit_incomplete;
 }
\ No newline at end of file
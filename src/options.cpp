@@ -0,0 +1,116 @@
+/// @file   options.cpp
+/// @brief  This file contains definition of converters of parameters of search engine.
+/// @author griha
+
+#include "options.h"
+
+#include <iostream>
+#include <string>
+
+#include <boost/program_options/errors.hpp>
+
+namespace po = boost::program_options;
+
+using namespace std::string_literals;
+
+namespace griha {
+
+std::ostream& operator<< (std::ostream& os, hash_algo hash) {
+    switch (hash) {
+    case hash_algo::md5: os << "md5"; break;
+    case hash_algo::sha256: os << "sha256"; break;
+    default:
+        throw po::invalid_option_value{ "expected: md5|sha256" };
+    }
+    return os;
+}
+
+std::istream& operator>> (std::istream& is, hash_algo& hash) {
+    std::string value;
+    is >> value;
+
+    if (value == "md5"s)
+        hash = hash_algo::md5;
+    else if (value == "sha256"s)
+        hash = hash_algo::sha256;
+    else
+        throw po::invalid_option_value{ "expected: md5|sha256" };
+    return is;
+}
+
+std::ostream& operator<< (std::ostream& os, io_mode io) {
+    switch (io) {
+    case io_mode::buffered: os << "buffered"; break;
+    case io_mode::fadvise: os << "fadvise"; break;
+    case io_mode::direct: os << "direct"; break;
+    default:
+        throw po::invalid_option_value{ "expected: buffered|fadvise|direct" };
+    }
+    return os;
+}
+
+std::istream& operator>> (std::istream& is, io_mode& io) {
+    std::string value;
+    is >> value;
+
+    if (value == "buffered"s)
+        io = io_mode::buffered;
+    else if (value == "fadvise"s)
+        io = io_mode::fadvise;
+    else if (value == "direct"s)
+        io = io_mode::direct;
+    else
+        throw po::invalid_option_value{ "expected: buffered|fadvise|direct" };
+    return is;
+}
+
+std::ostream& operator<< (std::ostream& os, reader_mode reader) {
+    switch (reader) {
+    case reader_mode::pread: os << "pread"; break;
+    case reader_mode::stdio: os << "stdio"; break;
+    default:
+        throw po::invalid_option_value{ "expected: pread|stdio" };
+    }
+    return os;
+}
+
+std::istream& operator>> (std::istream& is, reader_mode& reader) {
+    std::string value;
+    is >> value;
+
+    if (value == "pread"s)
+        reader = reader_mode::pread;
+    else if (value == "stdio"s)
+        reader = reader_mode::stdio;
+    else
+        throw po::invalid_option_value{ "expected: pread|stdio" };
+    return is;
+}
+
+std::ostream& operator<< (std::ostream& os, schedule_mode schedule) {
+    switch (schedule) {
+    case schedule_mode::stream: os << "stream"; break;
+    case schedule_mode::savings: os << "savings"; break;
+    case schedule_mode::latency: os << "latency"; break;
+    default:
+        throw po::invalid_option_value{ "expected: stream|savings|latency" };
+    }
+    return os;
+}
+
+std::istream& operator>> (std::istream& is, schedule_mode& schedule) {
+    std::string value;
+    is >> value;
+
+    if (value == "stream"s)
+        schedule = schedule_mode::stream;
+    else if (value == "savings"s)
+        schedule = schedule_mode::savings;
+    else if (value == "latency"s)
+        schedule = schedule_mode::latency;
+    else
+        throw po::invalid_option_value{ "expected: stream|savings|latency" };
+    return is;
+}
+
+} // namespace griha
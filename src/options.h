@@ -0,0 +1,32 @@
+/// @file   options.h
+/// @brief  This file contains declaration of converters of parameters of search engine
+///         from and to text of command line options.
+/// @author griha
+
+#pragma once
+
+#include <iosfwd>
+
+#include "search_engine.h"
+
+namespace griha {
+
+/// @name Converters of custom types have to be supported by @c boost::program_options
+/// @note Unknown value is rejected by @c boost::program_options::invalid_option_value
+/// @{
+
+std::ostream& operator<< (std::ostream& os, hash_algo hash);
+std::istream& operator>> (std::istream& is, hash_algo& hash);
+
+std::ostream& operator<< (std::ostream& os, io_mode io);
+std::istream& operator>> (std::istream& is, io_mode& io);
+
+std::ostream& operator<< (std::ostream& os, reader_mode reader);
+std::istream& operator>> (std::istream& is, reader_mode& reader);
+
+std::ostream& operator<< (std::ostream& os, schedule_mode schedule);
+std::istream& operator>> (std::istream& is, schedule_mode& schedule);
+
+/// @}
+
+} // namespace griha
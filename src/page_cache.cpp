@@ -0,0 +1,94 @@
+/// @file   page_cache.cpp
+/// @brief  This file contains definition of helpers to probe page cache residency of files.
+/// @author griha
+
+#include "page_cache.h"
+
+#include <cerrno>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __NR_cachestat
+#   include <linux/mman.h>
+#endif
+
+#include <boost/scope_exit.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+namespace {
+
+#ifdef __NR_cachestat
+
+/// @return Number of cached pages or -1 if @c cachestat isn't supported by running kernel
+long cached_pages_cachestat(int fd, uintmax_t file_size) {
+    // device workers probe files concurrently
+    static std::atomic<bool> supported { true };
+    if (!supported.load(std::memory_order_relaxed))
+        return -1;
+
+    struct cachestat_range range = { 0, file_size };
+    struct cachestat cs;
+    if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0)
+        return static_cast<long>(cs.nr_cache);
+
+    if (errno == ENOSYS)
+        supported.store(false, std::memory_order_relaxed);
+    return -1;
+}
+
+#else
+
+long cached_pages_cachestat(int, uintmax_t) {
+    return -1;
+}
+
+#endif
+
+long cached_pages_mincore(int fd, uintmax_t file_size, size_t pages) {
+    void* addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return 0;
+    BOOST_SCOPE_EXIT(addr, file_size) {
+        munmap(addr, file_size);
+    } BOOST_SCOPE_EXIT_END;
+
+    std::vector<unsigned char> vec(pages);
+    if (mincore(addr, file_size, vec.data()) == -1)
+        return 0;
+
+    return std::count_if(vec.begin(), vec.end(), [] (unsigned char v) { return (v & 1) != 0; });
+}
+
+} // unnamed namespace
+
+double cached_part(const fs::path& file_path, uintmax_t file_size) {
+    if (file_size == 0)
+        return 0.;
+
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return 0.;
+    BOOST_SCOPE_EXIT(&fd) {
+        close(fd);
+    } BOOST_SCOPE_EXIT_END;
+
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t pages = (file_size + page_size - 1) / page_size;
+
+    auto cached = cached_pages_cachestat(fd, file_size);
+    if (cached < 0)
+        cached = cached_pages_mincore(fd, file_size, pages);
+
+    return std::min(1., static_cast<double>(cached) / pages);
+}
+
+} // namespace griha
@@ -0,0 +1,21 @@
+/// @file   page_cache.h
+/// @brief  This file contains declaration of helpers to probe page cache residency of files.
+/// @author griha
+
+#pragma once
+
+#include <cstdint>
+
+#include <boost/filesystem/path.hpp>
+
+namespace griha {
+
+/// @brief Estimates part of file content residing in page cache
+/// @param file_path Path to file to be probed
+/// @param file_size Size of file in bytes
+/// @return Value in range [0, 1], 0 if file can't be probed
+/// @note @c cachestat system call is used if it's available, otherwise file is mapped
+///       into memory and probed by @c mincore. File content isn't read anyway.
+double cached_part(const boost::filesystem::path& file_path, uintmax_t file_size);
+
+} // namespace griha
@@ -0,0 +1,44 @@
+/// @file   path_filter.cpp
+/// @brief  This file contains definition of functions filtering paths of files to be scanned.
+/// @author griha
+
+#include "path_filter.h"
+
+#include <boost/range/algorithm.hpp>
+
+namespace fs = boost::filesystem;
+namespace rng = boost::range;
+
+namespace griha {
+
+bool is_excluded(const fs::path& path,
+                 const fs::path& path_exclude_from,
+                 const SearchEngine::paths_type& paths_exclude) {
+
+    if (paths_exclude.empty())
+        return false;
+
+    // path is listed under path excluded paths are relative to, so its prefix is just
+    // dropped without filesystem calls which can fail for files removed while scanning
+    const auto& base = path_exclude_from.native();
+    const auto p = path.native().compare(0, base.size(), base) == 0 ?
+        fs::path { path.native().substr(base.size()) }.relative_path() : path.relative_path();
+    const auto it = rng::find_if(paths_exclude, [&lhs = p] (const fs::path& rhs) {
+        return rng::search(lhs, rhs) != lhs.end();
+    });
+    return it != paths_exclude.end();
+}
+
+bool match_any(const fs::path& p, const SearchEngine::rxpatterns_type& patterns) {
+    if (patterns.empty())
+        return true;
+
+    for (const auto& pattern : patterns) {
+        if (!boost::regex_match(p.filename().string(), pattern))
+            continue;
+        return true;
+    }
+    return false;
+}
+
+} // namespace griha
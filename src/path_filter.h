@@ -0,0 +1,23 @@
+/// @file   path_filter.h
+/// @brief  This file contains declaration of functions filtering paths of files to be scanned.
+/// @author griha
+
+#pragma once
+
+#include "search_engine.h"
+
+namespace griha {
+
+/// @brief Checks whether path contains one of excluded paths
+/// @param path Path to be checked, it has to be listed under @c path_exclude_from
+/// @param path_exclude_from Path excluded paths are relative to
+/// @param paths_exclude Excluded paths
+bool is_excluded(const boost::filesystem::path& path,
+                 const boost::filesystem::path& path_exclude_from,
+                 const SearchEngine::paths_type& paths_exclude);
+
+/// @brief Checks whether file name matches one of patterns
+/// @return @c true if there is no pattern
+bool match_any(const boost::filesystem::path& p, const SearchEngine::rxpatterns_type& patterns);
+
+} // namespace griha
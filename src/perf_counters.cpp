@@ -0,0 +1,101 @@
+/// @file   perf_counters.cpp
+/// @brief  This file contains definition of PerfCounters class.
+/// @author griha
+
+#include "perf_counters.h"
+
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#   include <sys/ioctl.h>
+#   include <linux/perf_event.h>
+#endif
+
+namespace griha {
+
+#if defined(__linux__) && defined(__NR_perf_event_open)
+
+namespace {
+
+constexpr uint64_t c_events[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int perf_event_open(perf_event_attr& attr, int group_fd) {
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+}
+
+} // unnamed namespace
+
+PerfCounters::PerfCounters() {
+    for (auto& fd : fds_)
+        fd = -1;
+
+    for (size_t i = 0; i < sizeof(c_events) / sizeof(c_events[0]); ++i) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = c_events[i];
+        attr.disabled = i == 0; // group is started by leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds_[i] = perf_event_open(attr, i == 0 ? -1 : fds_[0]);
+        if (fds_[i] == -1) {
+            for (auto& fd : fds_) {
+                if (fd != -1)
+                    close(fd);
+                fd = -1;
+            }
+            return;
+        }
+    }
+
+    ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+    for (auto& fd : fds_)
+        fd = -1;
+}
+
+#endif
+
+PerfCounters::~PerfCounters() {
+    for (auto fd : fds_) {
+        if (fd != -1)
+            close(fd);
+    }
+}
+
+PerfValues PerfCounters::read() const {
+    PerfValues ret;
+    if (!valid())
+        return ret;
+
+    // nr, time enabled, time running and values of group
+    uint64_t data[3 + sizeof(fds_) / sizeof(fds_[0])];
+    if (::read(fds_[0], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        return ret;
+
+    const double scale = static_cast<double>(data[1]) / data[2];
+    const auto value = [&] (size_t i) { return static_cast<uint64_t>(data[3 + i] * scale); };
+    ret.cycles = value(0);
+    ret.instructions = value(1);
+    ret.cache_misses = value(2);
+    ret.branch_misses = value(3);
+    return ret;
+}
+
+} // namespace griha
@@ -0,0 +1,49 @@
+/// @file   perf_counters.h
+/// @brief  This file contains declaration of PerfCounters class counting hardware
+///         events of calling thread by @c perf_event_open.
+/// @author griha
+
+#pragma once
+
+#include <cstdint>
+
+namespace griha {
+
+/// @brief Hardware events counted in user space
+struct PerfValues {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cache_misses = 0;
+    uint64_t branch_misses = 0;
+
+    PerfValues& operator+= (const PerfValues& rhs) {
+        cycles += rhs.cycles;
+        instructions += rhs.instructions;
+        cache_misses += rhs.cache_misses;
+        branch_misses += rhs.branch_misses;
+        return *this;
+    }
+};
+
+class PerfCounters {
+public:
+    /// @brief Opens group of counters of calling thread and starts them
+    /// @note Check @c valid method before use, counters may be not permitted
+    ///       by @c perf_event_paranoid or not supported by virtual machine
+    PerfCounters();
+
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator= (const PerfCounters&) = delete;
+
+    bool valid() const { return fds_[0] != -1; }
+
+    /// @return Events counted since construction, they are scaled if counters were multiplexed
+    PerfValues read() const;
+
+private:
+    int fds_[4];
+};
+
+} // namespace griha
@@ -0,0 +1,14 @@
+/// @file   probes.cpp
+/// @brief  This file contains definition of semaphores of USDT probes of search engine.
+/// @author griha
+
+#include "probes.h"
+
+#ifdef BAYAN_USDT
+
+#define BAYAN_PROBE_SEMAPHORE(name) \
+    extern "C" { unsigned short bayan_##name##_semaphore __attribute__((section(".probes"))) = 0; }
+BAYAN_PROBES(BAYAN_PROBE_SEMAPHORE)
+#undef BAYAN_PROBE_SEMAPHORE
+
+#endif
@@ -0,0 +1,53 @@
+/// @file   probes.h
+/// @brief  This file contains declaration of USDT probes of search engine to be traced
+///         by bpftrace, perf or SystemTap.
+/// @details Probes are compiled in if @c sys/sdt.h is available and @c BAYAN_NO_USDT
+///          isn't defined. Probe is a single @c nop instruction until tracer is attached.
+///          Probe requiring additional work to compute its arguments is guarded by
+///          @c BAYAN_PROBE_ENABLED checking semaphore set by tracer.
+///          Provider is @c bayan, probes and their arguments:
+///          @li @c file_enqueue(path, file_size) - file is put into size bucket
+///          @li @c bucket_create(file_size, dev) - size bucket is created
+///          @li @c node_split(file_size, level) - leaf of tree of size bucket is split
+///          @li @c block_read_start(fd, offset, size) - reading of block, part or small file
+///          @li @c block_read_end(fd, offset, size) - reading is completed
+///          @li @c group_confirm(file_size, files) - group of duplicates is confirmed
+/// @author griha
+
+#pragma once
+
+#if !defined(BAYAN_NO_USDT) && defined(__has_include)
+#   if __has_include(<sys/sdt.h>)
+#       define BAYAN_USDT 1
+#   endif
+#endif
+
+#define BAYAN_PROBES(X) \
+    X(file_enqueue)     \
+    X(bucket_create)    \
+    X(node_split)       \
+    X(block_read_start) \
+    X(block_read_end)   \
+    X(group_confirm)
+
+#ifdef BAYAN_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/// @brief Semaphores are referenced by probes by their names, so they're global and unmangled
+#define BAYAN_PROBE_SEMAPHORE(name) extern "C" unsigned short bayan_##name##_semaphore;
+BAYAN_PROBES(BAYAN_PROBE_SEMAPHORE)
+#undef BAYAN_PROBE_SEMAPHORE
+
+#define BAYAN_PROBE2(name, a1, a2) STAP_PROBE2(bayan, name, a1, a2)
+#define BAYAN_PROBE3(name, a1, a2, a3) STAP_PROBE3(bayan, name, a1, a2, a3)
+#define BAYAN_PROBE_ENABLED(name) __builtin_expect(bayan_##name##_semaphore != 0, 0)
+
+#else
+
+#define BAYAN_PROBE2(name, a1, a2) do {} while (false)
+#define BAYAN_PROBE3(name, a1, a2, a3) do {} while (false)
+#define BAYAN_PROBE_ENABLED(name) false
+
+#endif
@@ -3,10 +3,35 @@
 /// @author griha
 
 #include "search_engine.h"
+#include "file_extents.h"
+#include "page_cache.h"
+#include "kernel_hash.h"
+#include "block_device.h"
+#include "throttle.h"
+#include "bounded_queue.h"
+#include "path_filter.h"
+#include "block_hasher.h"
+#include "block_source.h"
+#include "probes.h"
+#include "heap_stats.h"
+#include "perf_counters.h"
 
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <cstdio>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <boost/bind.hpp>
 #include <boost/container/map.hpp>
@@ -16,12 +41,8 @@
 #include <boost/range/algorithm.hpp>
 #include <boost/optional.hpp>
 #include <boost/scope_exit.hpp>
+#include <boost/align/aligned_allocator.hpp>
 
-#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
-#include <cryptopp/md5.h>
-#include <cryptopp/sha.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/base64.h>
 
 namespace fs = boost::filesystem;
 namespace cont = boost::container;
@@ -31,18 +52,52 @@ namespace griha {
 
 namespace {
 
-bool is_excluded(const fs::path& path,
-                 const fs::path& path_exclude_from,
-                 const SearchEngine::paths_type& paths_exclude) {
+/// @brief Maximum size of small file which content is used as key in a tree as is
+constexpr uintmax_t c_inline_key_max_size = 64;
 
-    if (paths_exclude.empty())
-        return false;
+/// @name Capacities of queues connecting stages of scanning
+/// @{
+constexpr size_t c_files_queue_capacity = 4096;
+constexpr size_t c_buckets_queue_capacity = 4096;
+constexpr size_t c_parts_queue_capacity = 4096;
+/// @}
+
+/// @brief Number of files of bucket taken by worker at once, rest is left for other workers
+constexpr size_t c_refine_batch_size = 64;
+
+/// @brief Number of locks shared by nodes of trees
+constexpr size_t c_node_locks_count = 1024;
+
+/// @brief Minimum size of part of chunk of large file hashed by one thread
+constexpr size_t c_large_part_size = 1024 * 1024;
 
-    const auto p = fs::relative(path, path_exclude_from);
-    const auto it = rng::find_if(paths_exclude, [&lhs = p] (const fs::path& rhs) {
-        return rng::search(lhs, rhs) != lhs.end();
-    });
-    return it != paths_exclude.end();
+/// @brief Alignment of buffer, offset and size of reads by-passing page cache
+constexpr size_t c_direct_io_alignment = 4096;
+
+size_t align_up(size_t size) {
+    return (size + c_direct_io_alignment - 1) & ~(c_direct_io_alignment - 1);
+}
+
+/// @brief Phases of scanning hardware events are counted by, output is counted by caller
+enum class perf_phase {
+    traversal, ///< enumerators listing directories
+    bucketing, ///< metadata workers putting files into size buckets
+    hashing    ///< workers of devices and hashing helpers
+};
+
+constexpr const char* c_perf_phase_names[] = { "traversal", "bucketing", "hashing" };
+
+/// @brief Thrown to stop scanning gracefully when one of its budgets is exhausted
+struct budget_exhausted : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+bool kernel_hash_supported(hash_algo algo) {
+    if (KernelHash { algo }.valid())
+        return true;
+
+    std::cerr << "kernel hashing isn't supported, hashing in user space is used" << std::endl;
+    return false;
 }
 
 template <typename DirIt, typename Func>
@@ -56,95 +111,469 @@ void apply_on_regular_files(DirIt f, DirIt l, SearchEngine::paths_type& excl_pat
     }
 }
 
-bool match_any(const fs::path& p, const SearchEngine::rxpatterns_type& patterns) {
-    if (patterns.empty())
-        return true;
-
-    for (const auto& pattern : patterns) {
-        if (!boost::regex_match(p.filename().string(), pattern))
-            continue;
-        return true;
-    }
-    return false;
-}
-
-CryptoPP::HashTransformation* make_hash(hash_algo algo) {
-    switch (algo) {
-    case hash_algo::md5:
-        // return boost::scoped_ptr<CryptoPP::HashTransformation> { new CryptoPP::Weak::MD5 {} };
-        return new CryptoPP::Weak::MD5 {};
-    case hash_algo::sha256:
-        return new CryptoPP::SHA256 {};
-    }
-    throw std::invalid_argument { "unknown hash agorithm" };
-}
-
 } // unnamed namespace
 
 struct SearchEngine::Impl : boost::intrusive_ref_counter<SearchEngine::Impl, boost::thread_unsafe_counter> {
 
     struct Node;
-    using nodes_type = cont::map<std::string, Node>;
+    using nodes_type = cont::map<std::string, Node, std::less<std::string>,
+        CountingAllocator<std::pair<const std::string, Node>, heap_category::nodes>>;
+    using files_type = cont::slist<fs::path, CountingAllocator<fs::path, heap_category::lists>>;
+    using shared_type = files_type;
     struct Node {
-        cont::slist<fs::path> files;
+        files_type files;
+        /// @brief Files sharing physical extents with one of @c files, they aren't read at all
+        /// @note List is owned by bucket, node refers to it to move it together with
+        ///       @c files when node is split
+        shared_type* shared = nullptr;
         nodes_type childs;
+        const std::string* digest = nullptr; ///< key of node in parent, null for root of bucket
+
+        /// @return Number of members of group of node, files sharing extents are members too
+        size_t size() const { return files.size() + (shared ? shared->size() : 0); }
     };
-    using roots_type = cont::map<uintmax_t, Node>;
+
+    struct Device;
+
+    /// @brief Root node of tree of files having the same size
+    struct Bucket : Node {
+        uintmax_t file_size = 0;
+
+        std::mutex guard;              ///< protects fields of collecting stage below
+        files_type pending;            ///< collected files not compared yet
+        size_t count = 0;              ///< number of collected files
+        bool queued = false;           ///< bucket is in I/O queue
+        size_t active = 0;             ///< number of workers refining bucket
+        bool interrupted = false;      ///< some files are left out of tree by stopped scanning
+        bool confirmed = false;        ///< groups of bucket are passed to handler
+        Device* device = nullptr;      ///< I/O queue bucket is refined in
+
+        std::mutex shared_guard; ///< protects lists of shared files and @c extents
+        cont::slist<shared_type, CountingAllocator<shared_type, heap_category::lists>> shared_lists;
+        /// @brief Lists of shared files by signature of extents
+        cont::map<std::string, shared_type*, std::less<std::string>,
+            CountingAllocator<std::pair<const std::string, shared_type*>, heap_category::lists>> extents;
+    };
+    using roots_type = cont::map<uintmax_t, Bucket, std::less<uintmax_t>,
+        CountingAllocator<std::pair<const uintmax_t, Bucket>, heap_category::buckets>>;
+
+    /// @brief File of size bucket to be compared with files sharing its extents
+    struct Candidate {
+        files_type file; ///< the only element moved from batch, it's spliced into node of tree
+                         ///< so file isn't reallocated on its way
+        std::string extents; ///< signature of extents, empty if it's unknown
+        files_type shared;
+        double cached;
+
+        const fs::path& path() const { return file.front(); }
+    };
+
+    /// @brief I/O queue of device, its size buckets are refined by own workers
+    struct Device {
+        bool rotational;
+        size_t concurrency;
+        BoundedQueue<Bucket*> buckets { c_buckets_queue_capacity };
+        std::vector<std::thread> workers;
+    };
+    using devices_type = cont::map<dev_t, Device>;
+
+    /// @brief Directory to be listed by traversal stage
+    struct Directory {
+        fs::path path;
+        const fs::path* exclude_from; ///< scan path excluded paths are relative to
+    };
+
+    struct Chunk;
+
+    /// @brief Part of chunk of large file passed to hashing helper
+    struct Part {
+        int fd;
+        off_t offset;
+        uintmax_t file_size;
+        std::string digest;
+        std::exception_ptr error;
+        Chunk* chunk;
+    };
+
+    /// @brief Chunk of large file being hashed by worker with help of hashing helpers
+    struct Chunk {
+        std::mutex guard;
+        std::condition_variable cv;
+        size_t left = 0; ///< number of parts not hashed yet by helpers
+
+        void done() {
+            // chunk may be destroyed by waiter right after counter becomes zero,
+            // so it's notified under the lock
+            std::lock_guard<std::mutex> lock { guard };
+            if (--left == 0)
+                cv.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock { guard };
+            cv.wait(lock, [this] { return left == 0; });
+        }
+    };
+
+    /// @brief State of stages of scanning connected by bounded queues
+    /// @details Enumerators list directories and pass paths of files to metadata workers.
+    ///          Metadata workers put files into size buckets and queue buckets
+    ///          to I/O queues of devices. Workers of I/O queues compare files of buckets.
+    ///          All stages run simultaneously, so buckets are refined while traversal
+    ///          isn't completed. Full queue holds back stage feeding it. The last thread
+    ///          of stage completes it, so scanning takes no threads besides ones of stages.
+    struct Pipeline {
+        std::mutex guard;
+        std::condition_variable cv;
+        std::vector<Directory> directories; ///< directories to be listed
+        size_t listing = 0;                 ///< number of directories being listed
+        std::vector<fs::path> scan_files;   ///< regular files of paths to be scanned, they're
+                                            ///< passed to metadata workers by enumerators
+        BoundedQueue<fs::path*> files { c_files_queue_capacity };
+        BoundedQueue<Part*> parts { c_parts_queue_capacity }; ///< it isn't cancelled on failure,
+                                                              ///< parts are waited by workers
+        std::atomic<bool> collected { false }; ///< all files are put into size buckets
+        std::atomic<bool> failed { false };
+        std::exception_ptr error;
+        std::atomic<uintmax_t> skipped_directories { 0 }; ///< directories failed to be listed
+        std::atomic<uintmax_t> skipped_files { 0 };       ///< files failed to be inspected or read
+        SearchEngine::deadline_type budget_deadline; ///< end of time budget
+        /// @name Numbers of threads of stages left, stage holds one more for stage feeding it
+        /// @{
+        std::atomic<size_t> enumerating { 0 };
+        std::atomic<size_t> inspecting { 0 };
+        std::atomic<size_t> refining { 0 };
+        std::atomic<size_t> helping { 0 };
+        /// @}
+        std::vector<std::thread> threads; ///< enumerators, metadata workers and hashing helpers
+        std::exception_ptr result; ///< error of completed scanning, exhausted budget isn't error
+        bool completed = false; ///< all stages are completed, it's protected by @c guard
+        std::array<PerfValues, std::size(c_perf_phase_names)> perf; ///< events counted by threads of phases,
+        bool perf_available = false;                                ///< they are protected by @c guard
+    };
+
+    struct Worker;
+    struct PerfScope;
 
     explicit Impl(SearchEngine::InitParams init_params)
-        : block_size(init_params.block_size)
+        : algo(init_params.algo)
+        , block_size(init_params.block_size)
         , file_min_size(init_params.file_min_size)
+        , small_file_size(init_params.small_file_size)
+        , large_file_size(init_params.large_file_size)
+        , detect_shared(init_params.detect_shared)
+        , cached_first(init_params.cached_first)
+        , kernel_hash(init_params.kernel_hash && kernel_hash_supported(init_params.algo))
+        , perf_counters(init_params.perf_counters)
+        , io(init_params.io)
+        , reader(init_params.reader)
+        , schedule(init_params.schedule)
+        , traversal_concurrency(std::max<size_t>(init_params.traversal_concurrency, 1))
+        , hdd_concurrency(std::max<size_t>(init_params.hdd_concurrency, 1))
+        , ssd_concurrency(init_params.ssd_concurrency != 0 ? init_params.ssd_concurrency :
+                              std::max(std::thread::hardware_concurrency(), 1u))
+        , hash_concurrency(init_params.hash_concurrency != 0 ? init_params.hash_concurrency :
+                               std::max(std::thread::hardware_concurrency(), 1u))
+        , part_size(std::max(block_size, c_large_part_size))
+        , time_budget(init_params.time_budget)
+        , read_budget(init_params.read_budget)
+        , throttle(init_params.max_read_rate, init_params.max_iops, std::move(init_params.throttle_file),
+                   init_params.reload_requests)
         , paths_scan(std::move(init_params.paths_scan))
         , paths_exclude(std::move(init_params.paths_exclude))
-        , rxpatterns(std::move(init_params.rxpatterns))
-        , hash(make_hash(init_params.algo))
-        , hash_filter(*hash, new CryptoPP::Base64Encoder(new CryptoPP::StringSink(hash_sink), false))
-        , buffer(init_params.block_size) {}
+        , rxpatterns(std::move(init_params.rxpatterns)) {}
 
+    const hash_algo algo;
     const size_t block_size;
     const size_t file_min_size;
+    const size_t small_file_size;
+    const size_t large_file_size;
+    const bool detect_shared;
+    const bool cached_first;
+    const bool kernel_hash;
+    const bool perf_counters;
+    const io_mode io;
+    const reader_mode reader;
+    const schedule_mode schedule;
+    const size_t traversal_concurrency;
+    const size_t hdd_concurrency;
+    const size_t ssd_concurrency;
+    const size_t hash_concurrency;
+    const size_t part_size; ///< size of part of chunk of large file
+    const std::chrono::seconds time_budget;
+    const uintmax_t read_budget;
+    mutable Throttle throttle; ///< shared by all workers
+    mutable std::atomic<uintmax_t> bytes_read { 0 };
     const SearchEngine::paths_type paths_scan;
     const SearchEngine::paths_type paths_exclude;
     const SearchEngine::rxpatterns_type rxpatterns;
 
-    /// @name hashing support fields
-    /// @note order of these fields initialization is important
-    /// @{
-    boost::scoped_ptr<CryptoPP::HashTransformation> hash;
-    std::string hash_sink;
-    CryptoPP::HashFilter hash_filter;
-    /// @}
+    /// @brief Locks of nodes of trees, node is locked by one of them chosen by its address
+    mutable std::array<std::mutex, c_node_locks_count> node_locks;
 
-    fs::path path_exclude_from;
+    std::mutex& lock_of(const Node& n) const {
+        return node_locks[(reinterpret_cast<uintptr_t>(&n) >> 4) % c_node_locks_count];
+    }
+
+    /// @brief Whether files of size are compared by chunks hashed in parallel instead of blocks
+    bool chunked(uintmax_t file_size) const {
+        return large_file_size != 0 && hash_concurrency > 1 && file_size >= large_file_size;
+    }
 
-    std::vector<char> buffer;
+    /// @brief Size of file content compared at one level of tree of size bucket
+    size_t level_size(uintmax_t file_size) const {
+        return chunked(file_size) ? part_size * hash_concurrency : block_size;
+    }
+
+    std::mutex roots_guard; ///< protects @c roots and @c devices while files are collected
     roots_type roots;
+    devices_type devices;
+
+    std::unique_ptr<Pipeline> pipeline; ///< pipeline of the last scanning
+
+    SearchEngine::Report report;
+    bool dry_run = false; ///< files are collected only, they aren't compared
+
+    SearchEngine::AsyncParams async;
+
+    ~Impl() {
+        wait();
+        clear();
+    }
+
+    /// @brief Returns child of node by digest of its level, it's created if doesn't exist
+    static Node& child(Node& n, const std::string& digest);
+
+    /// @brief Destroys tree of nodes without recursion, trees of large files are very deep
+    static void release(Node& n);
 
     void clear();
 
-    /// @brief Perfomrs hash function on current block
-    /// @param fd Input file stream
-    /// @return Digest value in base64 format
-    /// @note Returns constant reference on @hash_sink member
-    const std::string& hash_block(FILE* fd);
-    
+    /// @brief Accounts read of file content, caller is blocked if reading is throttled
+    /// @throw budget_exhausted if read budget doesn't allow reading of @c size bytes
+    void account(size_t size) const;
+
+    /// @brief Stores exception being handled and stops all stages of pipeline
+    void fail();
+
+    /// @brief Checks whether scanning is cancelled, its deadline is expired or its time
+    ///        budget is exhausted, it's called by stages between files and blocks
+    /// @throw budget_exhausted if time budget is exhausted
+    /// @throw std::system_error with @c operation_canceled or @c timed_out code if scanning
+    ///        is stopped by token or deadline of asynchronous parameters
+    void check_stop() const;
+
+    /// @brief Runs handler of asynchronous scanning by its executor
+    void post(SearchEngine::task_type task) const;
+
+    /// @brief Passes groups of duplicates of bucket to handler of asynchronous scanning
+    /// @note Bucket has to be refined completely
+    void confirm(const Bucket& bucket) const;
+
+    /// @brief Returns I/O queue of device, it's created with its workers on first request
+    /// @note @c roots_guard has to be locked
+    Device& device(dev_t dev);
+
+    /// @brief Lists directories of @c pipeline until all of them are listed
+    void enumerate(bool recursive);
+
+    /// @brief Passes entries of directory to metadata workers and sub-directories
+    ///        to enumerators if @c recursive
+    void list(const Directory& dir, bool recursive);
+
+    /// @brief Collects files passed by enumerators until traversal is completed
+    void inspect();
+
+    /// @brief Hashes parts of chunks of large files until all workers are completed
+    void help();
+
+    /// @brief Puts file into size bucket of @c roots without reading of its content
+    /// @note Bucket containing more than one file is queued to I/O queue of its device
+    ///       in @c stream schedule mode. Bucket containing files of different devices
+    ///       is queued to rotational one.
+    void collect(fs::path&& file_path);
+
+    /// @brief Queues buckets collected by traversal to I/O queues of devices in order
+    ///        of schedule mode
+    void schedule_buckets();
+
+    /// @name Completion of stage by its thread, the last one completes stage and leaves
+    ///       stage fed by it
+    /// @{
+    void enumerated();
+    void inspected();
+    void refined();
+    void helped();
+    /// @}
+
+    /// @brief Confirms buckets refined before traversal is completed and closes I/O queues
+    void traversed();
+
+    /// @brief Fills report, drops unresolved buckets and runs completion handler
+    void finish();
+
+    /// @brief Starts threads of pipeline without blocking of caller
+    /// @param recursive Scan directories recursively
+    void start(bool recursive);
+
+    /// @brief Waits for completion of pipeline and joins its threads
+    void wait();
+
+    /// @brief Scans paths blocking caller
+    void run(bool recursive);
+
+    /// @brief Estimates cost of comparing of files collected by dry run
+    SearchEngine::Estimate estimate() const;
+
+    /// @brief Writes anonymized shape of trees of size buckets, see @c SearchEngine::record_shape
+    void record_shape(std::ostream& os) const;
+
+    SearchEngine::Heap heap() const;
+};
+
+/// @brief Counts hardware events of calling thread for phase of scanning until it's destroyed
+/// @details Counters are opened per thread, so they don't count events of other stages
+///          running simultaneously. Kernel isn't counted, so reading of files and waiting
+///          on queues don't contribute.
+struct SearchEngine::Impl::PerfScope {
+
+    PerfScope(const Impl& e, perf_phase phase)
+        : pipeline(*e.pipeline)
+        , phase(phase) {
+        if (e.perf_counters)
+            counters.emplace();
+    }
+
+    ~PerfScope() {
+        if (!counters || !counters->valid())
+            return;
+
+        const auto values = counters->read();
+        std::lock_guard<std::mutex> lock { pipeline.guard };
+        pipeline.perf[static_cast<size_t>(phase)] += values;
+        pipeline.perf_available = true;
+    }
+
+    Pipeline& pipeline;
+    const perf_phase phase;
+    boost::optional<PerfCounters> counters;
+};
+
+/// @brief Compares files of size buckets, each thread refining buckets has its own worker
+struct SearchEngine::Impl::Worker {
+
+    explicit Worker(const Impl& e)
+        : engine(e)
+        , hasher(e.algo)
+        , kernel_hash(e.kernel_hash ? new KernelHash { e.algo } : nullptr)
+        , source(make_block_source(e.reader, e.io))
+        , buffer(std::max(e.block_size, e.small_file_size) + 2 * c_direct_io_alignment) {}
+
+    const Impl& engine;
+
+    BlockHasher hasher;
+
+    boost::scoped_ptr<KernelHash> kernel_hash;
+    std::string digest;
+
+    std::unique_ptr<BlockSource> source;
+
+    std::vector<char, boost::alignment::aligned_allocator<char, c_direct_io_alignment>> buffer;
+    std::vector<Part> parts; ///< parts of chunk passed to helpers
+
+    /// @name Buffers reused for each file and block, so steady state allocates nothing
+    /// @{
+    std::string key;      ///< key of node of candidate, it's copied out of @c hasher
+                          ///< as hasher is reused for residents of tree
+    std::string digests;  ///< digests of parts of chunk
+    std::vector<Candidate> candidates;
+    /// @}
+
     /// @brief Perfomrs hash function on block specified by @c level arguments
-    /// @param fd Input file stream
+    /// @param fd File descriptor opened by @c source
     /// @param level Value of level to describe a block to be hashed
+    /// @param file_size Size of file, only bytes of file are accounted for tail block
+    /// @return Digest value in base64 format
+    /// @note Returns constant reference on @c hasher buffer
+    const std::string& hash_block(int fd, size_t level, uintmax_t file_size);
+
+    /// @brief Perfomrs hash function on chunk of large file specified by @c level arguments
+    /// @details Chunk is split into parts hashed in parallel by this worker and hashing
+    ///          helpers. Digests of parts are hashed in order of parts, so result is
+    ///          deterministic. Parts after end of file are equal for all files of
+    ///          the same size, so they aren't hashed.
+    /// @param fd File descriptor opened by @c source
+    /// @param level Value of level to describe a chunk to be hashed
+    /// @param file_size Size of file
     /// @return Digest value in base64 format
-    /// @note Returns constant reference on @hash_sink member
-    const std::string& hash_block(FILE* fd, size_t level);
+    /// @note Returns constant reference on @c hasher buffer
+    const std::string& hash_chunk(int fd, size_t level, uintmax_t file_size);
 
-    void pre_process(const fs::path& file_path);
-    Node& process(FILE* fd, Node& n, size_t level);
-    void process(const fs::path& file_path);
-    void run(bool recursive);
+    /// @brief Performs hash function on part of chunk of large file
+    /// @param fd File descriptor
+    /// @param offset Offset of part
+    /// @param file_size Size of file, only bytes of file are accounted for tail part
+    /// @return Digest value in base64 format
+    /// @note Returns constant reference on @c hasher buffer
+    const std::string& hash_part(int fd, off_t offset, uintmax_t file_size);
+
+    /// @brief Reads whole content of small file by single @c read call
+    /// @param file_path Path to file to be read
+    /// @param file_size Size of file, it mustn't exceed @c small_file_size
+    /// @return Content of file as is if it's short enough, digest value in base64 format otherwise,
+    ///         @c nullptr if file can't be opened
+    /// @note Returns pointer to @c hasher buffer
+    const std::string* hash_file(const fs::path& file_path, uintmax_t file_size);
+
+    /// @brief Reads part of file into @c buffer by aligned reads, so it by-passes page cache
+    ///        if file is opened with @c O_DIRECT flag
+    /// @param fd File descriptor
+    /// @param offset Offset of part to be read
+    /// @param size Size of part to be read
+    /// @param[out] read_size Number of bytes read, rest of part is padded by zeros
+    /// @return Pointer to begin of part in @c buffer
+    const char* read_direct(int fd, off_t offset, size_t size, size_t& read_size);
+
+    /// @brief Puts candidate into files list of node and attaches files sharing its extents
+    /// @note Lock of node has to be held
+    void put(Bucket& bucket, Node& n, Candidate& c);
+
+    /// @brief Drops the first file of node which can't be read, file sharing extents
+    ///        with files of node takes its place if node has no more files
+    /// @return @c false if node has no file left
+    /// @note Lock of node has to be held
+    bool drop_resident(Bucket& bucket, Node& n);
+
+    /// @brief Returns child of node for block of newcomer, node is split if it's a leaf
+    /// @param n Node to be descended from
+    /// @param level Level of block of resident file to be compared if node is split
+    /// @param file_size Size of files of tree
+    /// @param block Digest of block of newcomer
+    /// @return @c nullptr if no resident file of leaf can be read, so newcomer takes their place
+    /// @note Lock of node has to be held
+    Node* process(Bucket& bucket, Node& n, size_t level, uintmax_t file_size, const std::string& block);
+
+    bool process_whole(Bucket& bucket, Candidate& c);
+
+    /// @brief Inserts file into tree of its size bucket
+    /// @details Nodes are locked one at a time while they are inspected or split and
+    ///          blocks of newcomer are read without any lock held, so many workers can
+    ///          insert files into the same tree simultaneously
+    /// @return @c false if file of candidate can't be opened, it's left out of tree
+    bool process(Bucket& bucket, Candidate& c);
+
+    /// @brief Compares files collected in size bucket until no pending files are left
+    void refine(Bucket& bucket);
+
+    /// @brief Compares batch of files collected in size bucket
+    void refine(Bucket& bucket, files_type& files);
 };
 
 
 struct SearchEngine::Iterator::Accessor::Impl {
     using node_type = SearchEngine::Impl::Node;
     const node_type* node;
+    uintmax_t file_size; ///< key of bucket node belongs to
 };
 
 struct SearchEngine::Iterator::Impl {
@@ -164,134 +593,1156 @@ struct SearchEngine::Iterator::Impl {
     void next();
 };
 
+auto SearchEngine::Impl::child(Node& n, const std::string& digest) -> Node& {
+    auto res = n.childs.try_emplace(digest);
+    if (res.second)
+        res.first->second.digest = &res.first->first;
+    return res.first->second;
+}
+
+void SearchEngine::Impl::release(Node& n) {
+    std::vector<nodes_type> nodes;
+    nodes.push_back(std::move(n.childs));
+
+    while (!nodes.empty()) {
+        auto childs = std::move(nodes.back());
+        nodes.pop_back();
+        for (auto& c : childs) {
+            if (!c.second.childs.empty())
+                nodes.push_back(std::move(c.second.childs));
+        }
+    }
+}
+
 void SearchEngine::Impl::clear() {
+    for (auto& r : roots)
+        release(r.second);
+
     roots.clear();
+    devices.clear();
 }
 
-const std::string& SearchEngine::Impl::hash_block(FILE* fd) {
-    assert(feof(fd) == 0 && ferror(fd) == 0);
+void SearchEngine::Impl::account(size_t size) const {
+    check_stop();
 
-    auto size = fread(buffer.data(), sizeof(char), block_size, fd);
-    if (size != block_size)
-        rng::fill(buffer | boost::adaptors::sliced(size, block_size), '\0');
+    if (bytes_read.fetch_add(size) + size > read_budget && read_budget != 0) {
+        bytes_read -= size;
+        throw budget_exhausted { "read budget is exhausted" };
+    }
 
-    hash_sink.clear(); // actually this call never reduces the capacity of string
-    hash_filter.PutMessageEnd(reinterpret_cast<uint8_t*>(buffer.data()), block_size);
-    return hash_sink;
+    throttle.acquire(size);
 }
 
-const std::string& SearchEngine::Impl::hash_block(FILE* fd, size_t level) {
-    assert(feof(fd) == 0 && ferror(fd) == 0);
+void SearchEngine::Impl::fail() {
+    {
+        std::lock_guard<std::mutex> lock { pipeline->guard };
+        if (!pipeline->error)
+            pipeline->error = std::current_exception();
+    }
+
+    pipeline->failed = true;
+    pipeline->cv.notify_all();
+    pipeline->files.cancel();
+
+    std::lock_guard<std::mutex> lock { roots_guard };
+    for (auto& d : devices)
+        d.second.buckets.cancel();
+}
 
-    auto offset = level * block_size;
-    fseek(fd, offset, SEEK_SET);
-    assert(feof(fd) == 0 && ferror(fd) == 0);
+void SearchEngine::Impl::check_stop() const {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= pipeline->budget_deadline)
+        throw budget_exhausted { "time budget is exhausted" };
 
-    return hash_block(fd);
+    if (async.token.cancelled() || now >= async.deadline)
+        throw std::system_error { std::make_error_code(async.token.cancelled() ?
+                                      std::errc::operation_canceled : std::errc::timed_out),
+                                  "scanning is stopped" };
 }
 
-void SearchEngine::Impl::pre_process(const fs::path& file_path) {
-    if (is_excluded(file_path, path_exclude_from, paths_exclude) ||
-            !fs::is_regular_file(file_path))
+void SearchEngine::Impl::post(SearchEngine::task_type task) const {
+    if (async.executor)
+        async.executor(std::move(task));
+    else
+        task();
+}
+
+void SearchEngine::Impl::confirm(const Bucket& bucket) const {
+    // groups are walked for tracer too
+    if (!async.on_group && !BAYAN_PROBE_ENABLED(group_confirm))
         return;
 
-    process(file_path);
+    std::vector<const Node*> nodes { &bucket };
+    while (!nodes.empty()) {
+        const Node* n = nodes.back();
+        nodes.pop_back();
+        for (const auto& c : n->childs)
+            nodes.push_back(&c.second);
+
+        const auto size = n->size();
+        if (size < 2)
+            continue;
+
+        BAYAN_PROBE2(group_confirm, bucket.file_size, size);
+        if (!async.on_group)
+            continue;
+
+        const auto& handler = async.on_group;
+        SearchEngine::Iterator::Accessor accessor { new SearchEngine::Iterator::Accessor::Impl { n, bucket.file_size } };
+        post([handler, accessor] { handler(accessor); });
+    }
 }
 
-SearchEngine::Impl::Node& SearchEngine::Impl::process(FILE* fd, Node& n, size_t level) {
-    assert(feof(fd) == 0 && n.files.empty() != n.childs.empty());
+auto SearchEngine::Impl::device(dev_t dev) -> Device& {
+    auto it = devices.find(dev);
+    if (it != devices.end())
+        return it->second;
+
+    auto& d = devices[dev];
+    d.rotational = is_rotational(dev);
+    d.concurrency = d.rotational ? hdd_concurrency : ssd_concurrency;
+    if (dry_run)
+        return d;
+    for (size_t i = 0; i < d.concurrency; ++i) {
+        ++pipeline->refining;
+        d.workers.emplace_back([this, &d] {
+            {
+                PerfScope perf { *this, perf_phase::hashing };
+                try {
+                    Worker worker { *this };
+                    for (Bucket* b; d.buckets.pop(b);)
+                        worker.refine(*b);
+                } catch (...) {
+                    fail();
+                }
+            }
+            refined();
+        });
+    }
+    return d;
+}
 
-    if (n.childs.empty()) {
-        FILE* fd_to_compare = fopen(n.files.front().string().data(), "r");
-        BOOST_SCOPE_EXIT(&fd_to_compare) {
-            fclose(fd_to_compare);
-        } BOOST_SCOPE_EXIT_END;
+void SearchEngine::Impl::enumerate(bool recursive) {
+    PerfScope perf { *this, perf_phase::traversal };
+    auto& p = *pipeline;
+    for (;;) {
+        std::unique_ptr<fs::path> file_path;
+        {
+            std::lock_guard<std::mutex> lock { p.guard };
+            if (p.scan_files.empty() || p.failed)
+                break;
+
+            file_path.reset(new fs::path { std::move(p.scan_files.back()) });
+            p.scan_files.pop_back();
+        }
 
-        setbuf(fd_to_compare, nullptr);
+        if (!p.files.push(file_path.get()))
+            break; // pipeline is cancelled
+        file_path.release();
+    }
 
-        auto block_to_compare = hash_block(fd_to_compare, level);
-        auto& nn = n.childs[std::move(block_to_compare)];
-        nn.files.swap(n.files);
+    for (;;) {
+        Directory dir;
+        {
+            std::unique_lock<std::mutex> lock { p.guard };
+            p.cv.wait(lock, [&p] { return !p.directories.empty() || p.listing == 0 || p.failed; });
+            if (p.directories.empty() || p.failed)
+                break;
+
+            dir = std::move(p.directories.back());
+            p.directories.pop_back();
+            ++p.listing;
+        }
+
+        try {
+            list(dir, recursive);
+        } catch (...) {
+            fail();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock { p.guard };
+            --p.listing;
+        }
+        p.cv.notify_all();
     }
+}
+
+void SearchEngine::Impl::list(const Directory& dir, bool recursive) {
+    // directory may be removed or be not permitted to be listed, it's skipped then
+    // like its entries left after error
+    boost::system::error_code ec;
+    BOOST_SCOPE_EXIT(&ec, this_) {
+        if (ec)
+            ++this_->pipeline->skipped_directories;
+    } BOOST_SCOPE_EXIT_END;
+
+    for (fs::directory_iterator it { dir.path, ec }, end; it != end && !ec; it.increment(ec)) {
+        check_stop();
+
+        const auto& path = it->path();
 
-    auto block = hash_block(fd);
-    return n.childs[std::move(block)];
+        // no file of excluded directory can be not excluded, so it isn't listed at all
+        if (is_excluded(path, *dir.exclude_from, paths_exclude))
+            continue;
+
+        boost::system::error_code status_ec;
+        const auto status = it->symlink_status(status_ec);
+        if (status_ec) {
+            ++pipeline->skipped_files; // entry is removed while listing
+            continue;
+        }
+
+        if (recursive && fs::is_directory(status)) {
+            {
+                std::lock_guard<std::mutex> lock { pipeline->guard };
+                pipeline->directories.push_back(Directory { path, dir.exclude_from });
+            }
+            pipeline->cv.notify_one();
+            continue;
+        }
+
+        std::unique_ptr<fs::path> file_path { new fs::path { path } };
+        if (!pipeline->files.push(file_path.get()))
+            return; // pipeline is cancelled
+        file_path.release();
+    }
 }
 
+void SearchEngine::Impl::inspect() {
+    PerfScope perf { *this, perf_phase::bucketing };
+    for (fs::path* p; pipeline->files.pop(p);) {
+        std::unique_ptr<fs::path> file_path { p };
+        try {
+            check_stop();
+            collect(std::move(*file_path));
+        } catch (...) {
+            fail();
+        }
+    }
+}
 
-void SearchEngine::Impl::process(const fs::path& file_path) {
+void SearchEngine::Impl::help() {
+    PerfScope perf { *this, perf_phase::hashing };
+
+    // worker is created on first part, so helpers don't allocate buffers when
+    // no large files are met
+    boost::optional<Worker> worker;
+    for (Part* part; pipeline->parts.pop(part); part->chunk->done()) {
+        try {
+            if (!worker)
+                worker.emplace(*this);
+            part->digest = worker->hash_part(part->fd, part->offset, part->file_size);
+        } catch (...) {
+            part->error = std::current_exception();
+        }
+    }
+}
+
+void SearchEngine::Impl::collect(fs::path&& file_path) {
     if (!match_any(file_path, rxpatterns))
         return;
-    
-    auto file_size = fs::file_size(file_path);
-    if (file_size < file_min_size)
+
+    // file may be removed after listing
+    struct stat st;
+    if (stat(file_path.c_str(), &st) == -1) {
+        ++pipeline->skipped_files;
         return;
+    }
 
-    auto it = roots.find(file_size);
-    if (it == roots.end()) {
-        // no comparison required
-        auto& n = roots[file_size];
-        n.files.push_front(file_path);
+    const uintmax_t file_size = st.st_size;
+    if (!S_ISREG(st.st_mode) || file_size < file_min_size)
         return;
+
+    BAYAN_PROBE2(file_enqueue, file_path.c_str(), file_size);
+
+    Bucket* b;
+    Device* d;
+    {
+        std::lock_guard<std::mutex> lock { roots_guard };
+        const auto count = roots.size();
+        b = &roots[file_size];
+        if (roots.size() != count) {
+            BAYAN_PROBE2(bucket_create, file_size, st.st_dev);
+            b->file_size = file_size; // new bucket isn't visible for workers yet
+        }
+        d = &device(st.st_dev);
+    }
+
+    bool queue;
+    {
+        std::lock_guard<std::mutex> lock { b->guard };
+        b->pending.push_front(std::move(file_path));
+        if (b->device == nullptr || !b->device->rotational)
+            b->device = d;
+
+        queue = ++b->count > 1 && !b->queued && schedule == schedule_mode::stream && !dry_run;
+        b->queued = b->queued || queue;
+        d = b->device;
+    }
+
+    // bucket is queued outside of its lock, so full queue doesn't block its workers
+    if (queue)
+        d->buckets.push(b);
+}
+
+void SearchEngine::Impl::schedule_buckets() {
+    std::vector<Bucket*> buckets;
+    for (auto& r : roots) {
+        if (r.second.count > 1)
+            buckets.push_back(&r.second);
+    }
+
+    if (schedule == schedule_mode::savings) {
+        // space wasted by duplicates can't exceed size of all files except one
+        std::stable_sort(buckets.begin(), buckets.end(), [] (const Bucket* lhs, const Bucket* rhs) {
+            return lhs->file_size * (lhs->count - 1) > rhs->file_size * (rhs->count - 1);
+        });
+    } else {
+        // all files of bucket are read once at most
+        std::stable_sort(buckets.begin(), buckets.end(), [] (const Bucket* lhs, const Bucket* rhs) {
+            return lhs->file_size * lhs->count < rhs->file_size * rhs->count;
+        });
+    }
+
+    for (auto b : buckets) {
+        Device* d;
+        {
+            std::lock_guard<std::mutex> lock { b->guard };
+            b->queued = true;
+            d = b->device;
+        }
+        if (!d->buckets.push(b))
+            break; // pipeline is cancelled
+    }
+}
+
+auto SearchEngine::Impl::estimate() const -> SearchEngine::Estimate {
+    SearchEngine::Estimate ret;
+
+    cont::map<const Device*, size_t> indices;
+    for (const auto& d : devices) {
+        indices[&d.second] = ret.devices.size();
+        ret.devices.push_back(SearchEngine::Estimate::Device { d.first, d.second.rotational });
+    }
+
+    for (const auto& r : roots) {
+        const auto& b = r.second;
+        ret.files += b.count;
+        if (b.count < 2 || b.file_size == 0)
+            continue;
+
+        auto& e = ret.devices[indices[b.device]];
+        ++e.buckets;
+        e.files += b.count;
+        e.bytes += b.file_size * b.count;
+
+        // small file is read by single call once, resident one is read once too
+        if (b.file_size <= small_file_size) {
+            e.min_read += b.file_size * b.count;
+            e.min_ops += b.count;
+            e.max_read += b.file_size * b.count;
+            e.max_ops += b.count;
+            continue;
+        }
+
+        // all files are read at the first level at least, equal files are read completely
+        const uintmax_t level = std::min<uintmax_t>(level_size(b.file_size), b.file_size);
+        const uintmax_t levels = (b.file_size + level - 1) / level;
+        const uintmax_t level_ops = chunked(b.file_size) ? (level + part_size - 1) / part_size : 1;
+        e.min_read += level * b.count;
+        e.min_ops += level_ops * b.count;
+        e.max_read += b.file_size * b.count;
+        e.max_ops += level_ops * levels * b.count;
+    }
+
+    return ret;
+}
+
+auto SearchEngine::Impl::heap() const -> SearchEngine::Heap {
+    SearchEngine::Heap ret;
+
+    // string keeps short value inside, only longer ones are allocated
+    static const size_t inline_capacity = std::string {}.capacity();
+    const auto size_of = [] (const std::string& s) -> uintmax_t {
+        return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+    };
+
+    SearchEngine::Heap::Category paths { "paths" }, keys { "keys" };
+    const auto count_paths = [&] (const files_type& files) {
+        for (const auto& f : files) {
+            const auto size = size_of(f.native());
+            paths.bytes += size;
+            paths.blocks += size != 0;
+            ++ret.files;
+        }
+    };
+    const auto count_key = [&] (const std::string& key) {
+        const auto size = size_of(key);
+        keys.bytes += size;
+        keys.blocks += size != 0;
+    };
+
+    for (const auto& r : roots) {
+        const auto& b = r.second;
+        count_paths(b.pending);
+        for (const auto& shared : b.shared_lists)
+            count_paths(shared);
+        for (const auto& e : b.extents)
+            count_key(e.first);
+
+        std::vector<const Node*> nodes { &b };
+        while (!nodes.empty()) {
+            const Node* n = nodes.back();
+            nodes.pop_back();
+            count_paths(n->files);
+            for (const auto& c : n->childs) {
+                count_key(c.first);
+                nodes.push_back(&c.second);
+            }
+        }
+    }
+
+    paths.peak = paths.bytes;
+    paths.allocations = paths.blocks;
+    keys.peak = keys.bytes;
+    keys.allocations = keys.blocks;
+    ret.categories.push_back(paths);
+    ret.categories.push_back(keys);
+
+    for (size_t i = 0; i < static_cast<size_t>(heap_category::count); ++i) {
+        const auto category = static_cast<heap_category>(i);
+        const auto& c = heap_counters(category);
+        ret.categories.push_back(SearchEngine::Heap::Category { heap_category_name(category),
+            c.bytes, c.peak, c.blocks, c.allocations });
     }
 
-    FILE* fd = fopen(file_path.string().data(), "r");
-    BOOST_SCOPE_EXIT(&fd) {
-        fclose(fd);
+    return ret;
+}
+
+void SearchEngine::Impl::record_shape(std::ostream& os) const {
+    os << "bayan-shape 1\n";
+
+    // directories are numbered in order of appearance, ancestors are written before
+    // descendants and paths to be scanned are roots
+    cont::map<fs::path, size_t> dirs;
+    const auto dir_of = [&] (const fs::path& file_path) {
+        std::vector<fs::path> chain;
+        size_t parent = 0;
+        bool root = true;
+        for (auto dir = file_path.parent_path();; dir = dir.parent_path()) {
+            const auto it = dirs.find(dir);
+            if (it != dirs.end()) {
+                parent = it->second;
+                root = false;
+                break;
+            }
+            chain.push_back(dir);
+            if (dir.empty() || rng::find(paths_scan, dir) != paths_scan.end())
+                break;
+        }
+
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            const size_t id = dirs.size();
+            dirs.emplace(*it, id);
+            os << "d " << id << ' ';
+            if (root)
+                os << "-\n";
+            else
+                os << parent << '\n';
+            parent = id;
+            root = false;
+        }
+        return parent;
+    };
+
+    // path of node is sequence of indices of childs from root, repeated indices
+    // are run-length encoded since trees of equal large files are long chains
+    std::vector<std::pair<size_t, size_t>> path;
+    const auto put_files = [&] (const Node& n) {
+        std::ostringstream key;
+        for (const auto& run : path) {
+            if (&run != &path.front())
+                key << '.';
+            key << run.first;
+            if (run.second > 1)
+                key << '*' << run.second;
+        }
+        const auto k = path.empty() ? std::string { "-" } : key.str();
+
+        for (const auto& f : n.files) {
+            const auto dir = dir_of(f);
+            os << "f " << dir << ' ' << k << '\n';
+        }
+        if (n.shared == nullptr)
+            return;
+        for (const auto& f : *n.shared) {
+            const auto dir = dir_of(f);
+            os << "f " << dir << ' ' << k << '\n';
+        }
+    };
+
+    struct Frame {
+        const Node* node;
+        nodes_type::const_iterator next;
+        size_t index;
+    };
+
+    for (const auto& r : roots) {
+        const auto& b = r.second;
+        const bool whole = b.file_size != 0 && b.file_size <= small_file_size;
+        os << "b " << b.file_size << ' ' << (whole ? b.file_size : level_size(b.file_size)) << '\n';
+
+        put_files(b);
+        std::vector<Frame> stack { Frame { &b, b.childs.begin(), 0 } };
+        while (!stack.empty()) {
+            auto& f = stack.back();
+            if (f.next == f.node->childs.end()) {
+                stack.pop_back();
+                if (!stack.empty() && --path.back().second == 0)
+                    path.pop_back();
+                continue;
+            }
+
+            const auto& c = f.next->second;
+            const auto index = f.index++;
+            ++f.next;
+
+            if (!path.empty() && path.back().first == index)
+                ++path.back().second;
+            else
+                path.emplace_back(index, 1);
+            put_files(c);
+            stack.push_back(Frame { &c, c.childs.begin(), 0 });
+        }
+    }
+}
+
+const std::string& SearchEngine::Impl::Worker::hash_block(int fd, size_t level, uintmax_t file_size) {
+    const off_t offset = level * engine.block_size;
+    assert(static_cast<uintmax_t>(offset) < file_size);
+
+    // tail block is padded by zeros, they aren't read
+    engine.account(std::min<uintmax_t>(engine.block_size, file_size - offset));
+
+    BAYAN_PROBE3(block_read_start, fd, offset, engine.block_size);
+
+    if (kernel_hash) {
+        const auto size = kernel_hash->digest(fd, offset, engine.block_size, digest);
+        if (size >= 0) {
+            BAYAN_PROBE3(block_read_end, fd, offset, size);
+            return hasher.encode(digest);
+        }
+        // kernel digest is the same, so block is rehashed in user space
+    }
+
+    // aligned reads by-passing page cache are done by worker itself, source reads the rest
+    const char* data = buffer.data();
+    size_t size;
+    if (engine.io == io_mode::direct) {
+        data = read_direct(fd, offset, engine.block_size, size);
+    } else {
+        size = source->read(fd, offset, buffer.data(), engine.block_size);
+        if (size != engine.block_size)
+            rng::fill(buffer | boost::adaptors::sliced(size, engine.block_size), '\0');
+    }
+    BAYAN_PROBE3(block_read_end, fd, offset, size);
+
+    return hasher.hash(data, engine.block_size);
+}
+
+const std::string& SearchEngine::Impl::Worker::hash_chunk(int fd, size_t level, uintmax_t file_size) {
+    const off_t offset = level * engine.level_size(file_size);
+    assert(static_cast<uintmax_t>(offset) < file_size);
+
+    const size_t count = std::min<uintmax_t>(engine.hash_concurrency,
+        (file_size - offset + engine.part_size - 1) / engine.part_size);
+    parts.resize(count - 1);
+
+    Chunk chunk;
+    for (size_t i = 1; i < count; ++i) {
+        auto& part = parts[i - 1];
+        part.fd = fd;
+        part.offset = offset + i * engine.part_size;
+        part.file_size = file_size;
+        part.error = nullptr;
+        part.chunk = &chunk;
+
+        {
+            std::lock_guard<std::mutex> lock { chunk.guard };
+            ++chunk.left;
+        }
+        // parts queue is never cancelled, so part is always pushed
+        engine.pipeline->parts.push(&part);
+    }
+
+    // first part is hashed by worker itself, parts passed to helpers
+    // have to be waited for even if it fails
+    std::exception_ptr error;
+    try {
+        digests = hash_part(fd, offset, file_size);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    chunk.wait();
+
+    if (error)
+        std::rethrow_exception(error);
+    for (const auto& part : parts) {
+        if (part.error)
+            std::rethrow_exception(part.error);
+        digests += part.digest;
+    }
+
+    return hasher.hash(digests.data(), digests.size());
+}
+
+const std::string& SearchEngine::Impl::Worker::hash_part(int fd, off_t offset, uintmax_t file_size) {
+    const auto size = engine.part_size;
+
+    engine.account(std::min<uintmax_t>(size, file_size - offset));
+
+    BAYAN_PROBE3(block_read_start, fd, offset, size);
+
+    if (kernel_hash) {
+        const auto read_size = kernel_hash->digest(fd, offset, size, digest);
+        if (read_size >= 0) {
+            BAYAN_PROBE3(block_read_end, fd, offset, read_size);
+            return hasher.encode(digest);
+        }
+    }
+
+    if (buffer.size() < size + 2 * c_direct_io_alignment)
+        buffer.resize(size + 2 * c_direct_io_alignment);
+
+    size_t read_size;
+    const char* data = read_direct(fd, offset, size, read_size);
+    BAYAN_PROBE3(block_read_end, fd, offset, read_size);
+
+    return hasher.hash(data, size);
+}
+
+const std::string* SearchEngine::Impl::Worker::hash_file(const fs::path& file_path, uintmax_t file_size) {
+    assert(file_size <= engine.small_file_size);
+
+    int fd = source->open(file_path);
+    if (fd == -1)
+        return nullptr;
+    BOOST_SCOPE_EXIT(&fd, this_) {
+        this_->source->close(fd);
     } BOOST_SCOPE_EXIT_END;
 
-    setbuf(fd, nullptr);
+    engine.account(file_size);
+
+    BAYAN_PROBE3(block_read_start, fd, 0, file_size);
+
+    const char* data = buffer.data();
+    size_t size = 0;
+    if (engine.io == io_mode::direct) {
+        data = read_direct(fd, 0, file_size, size);
+    } else {
+        size = source->read(fd, 0, buffer.data(), file_size);
+        if (size != file_size)
+            rng::fill(buffer | boost::adaptors::sliced(size, file_size), '\0');
+    }
+    BAYAN_PROBE3(block_read_end, fd, 0, size);
+
+    if (file_size <= c_inline_key_max_size)
+        return &hasher.assign(data, file_size);
+
+    return &hasher.hash(data, file_size);
+}
+
+const char* SearchEngine::Impl::Worker::read_direct(int fd, off_t offset, size_t size, size_t& read_size) {
+    const off_t aligned_offset = offset & ~static_cast<off_t>(c_direct_io_alignment - 1);
+    const size_t head = offset - aligned_offset;
+    const size_t length = align_up(head + size);
+    assert(length <= buffer.size());
+
+    size_t n = 0;
+    for (ssize_t ret; n < length; n += ret) {
+        ret = pread(fd, buffer.data() + n, length - n, aligned_offset + n);
+        if (ret <= 0)
+            break; // end of file is reached
+    }
 
-    size_t level = 0;
-    for (auto n = &it->second;; 
-         n = &process(fd, *n, level), ++level) {
-        if ((level * block_size) >= file_size || (n->files.empty() && n->childs.empty())) {
-            n->files.push_front(file_path);
-            break;
+    read_size = n > head ? std::min(n - head, size) : 0;
+    if (read_size != size)
+        rng::fill(buffer | boost::adaptors::sliced(head + read_size, head + size), '\0');
+    return buffer.data() + head;
+}
+
+void SearchEngine::Impl::Worker::put(Bucket& bucket, Node& n, Candidate& c) {
+    n.files.splice_after(n.files.before_begin(), c.file);
+    if (c.extents.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock { bucket.shared_guard };
+    if (n.shared == nullptr) {
+        bucket.shared_lists.emplace_front();
+        n.shared = &bucket.shared_lists.front();
+    }
+    n.shared->splice(n.shared->end(), c.shared);
+    bucket.extents.emplace(std::move(c.extents), n.shared);
+}
+
+bool SearchEngine::Impl::Worker::drop_resident(Bucket& bucket, Node& n) {
+    n.files.pop_front();
+    ++engine.pipeline->skipped_files;
+    if (!n.files.empty() || n.shared == nullptr)
+        return !n.files.empty();
+
+    std::lock_guard<std::mutex> lock { bucket.shared_guard };
+    if (!n.shared->empty())
+        n.files.splice_after(n.files.before_begin(), *n.shared, n.shared->before_begin());
+    return !n.files.empty();
+}
+
+auto SearchEngine::Impl::Worker::process(Bucket& bucket, Node& n, size_t level, uintmax_t file_size,
+                                         const std::string& block) -> Node* {
+    assert(n.files.empty() != n.childs.empty());
+
+    if (n.childs.empty()) {
+        BAYAN_PROBE2(node_split, file_size, level);
+
+        int fd_to_compare;
+        while ((fd_to_compare = source->open(n.files.front())) == -1) {
+            if (!drop_resident(bucket, n))
+                return nullptr;
         }
+        BOOST_SCOPE_EXIT(&fd_to_compare, this_) {
+            this_->source->close(fd_to_compare);
+        } BOOST_SCOPE_EXIT_END;
+
+        auto& nn = child(n, engine.chunked(file_size) ? hash_chunk(fd_to_compare, level, file_size) :
+                                                         hash_block(fd_to_compare, level, file_size));
+        nn.files.swap(n.files);
+        std::swap(nn.shared, n.shared);
     }
+
+    return &child(n, block);
 }
 
-void SearchEngine::Impl::run(bool recursive) {
+bool SearchEngine::Impl::Worker::process_whole(Bucket& bucket, Candidate& c) {
+    const auto digest = hash_file(c.path(), bucket.file_size);
+    if (digest == nullptr)
+        return false;
+    key = *digest;
+
+    Node* n;
+    {
+        std::lock_guard<std::mutex> lock { engine.lock_of(bucket) };
+        assert(bucket.files.empty() != bucket.childs.empty());
+
+        // tree of small files has the only level which keys are whole contents of files,
+        // so resident file is read once when the second file of the same size is met
+        if (bucket.childs.empty()) {
+            const std::string* resident;
+            while ((resident = hash_file(bucket.files.front(), bucket.file_size)) == nullptr) {
+                if (!drop_resident(bucket, bucket)) {
+                    put(bucket, bucket, c);
+                    return true;
+                }
+            }
+
+            auto& nn = child(bucket, *resident);
+            nn.files.swap(bucket.files);
+            std::swap(nn.shared, bucket.shared);
+        }
+        n = &child(bucket, key);
+    }
+
+    std::lock_guard<std::mutex> lock { engine.lock_of(*n) };
+    put(bucket, *n, c);
+    return true;
+}
+
+bool SearchEngine::Impl::Worker::process(Bucket& bucket, Candidate& c) {
+    const auto file_size = bucket.file_size;
+    {
+        std::lock_guard<std::mutex> lock { engine.lock_of(bucket) };
+        if (bucket.files.empty() && bucket.childs.empty()) {
+            // no comparison required
+            put(bucket, bucket, c);
+            return true;
+        }
+    }
+
+    if (file_size != 0 && file_size <= engine.small_file_size)
+        return process_whole(bucket, c);
+
+    int fd = source->open(c.path());
+    if (fd == -1)
+        return false;
+    BOOST_SCOPE_EXIT(&fd, this_) {
+        this_->source->close(fd);
+    } BOOST_SCOPE_EXIT_END;
+
+    const bool chunked = engine.chunked(file_size);
+    const size_t level_size = engine.level_size(file_size);
+
+    Node* n = &bucket;
+    for (size_t level = 0;; ++level) {
+        engine.check_stop();
+        if (engine.pipeline->failed) {
+            // file is left out of tree of stopped scanning
+            std::lock_guard<std::mutex> lock { bucket.guard };
+            bucket.interrupted = true;
+            return true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock { engine.lock_of(*n) };
+            if ((level * level_size) >= file_size || (n->files.empty() && n->childs.empty())) {
+                put(bucket, *n, c);
+                return true;
+            }
+        }
+
+        key = chunked ? hash_chunk(fd, level, file_size) : hash_block(fd, level, file_size);
+
+        std::lock_guard<std::mutex> lock { engine.lock_of(*n) };
+        if (auto nn = process(bucket, *n, level, file_size, key)) {
+            n = nn;
+            continue;
+        }
+        // no file of leaf can be read anymore, so newcomer takes their place
+        put(bucket, *n, c);
+        return true;
+    }
+}
+
+void SearchEngine::Impl::Worker::refine(Bucket& bucket) {
+    Device* d;
+    bool confirm = false;
+    {
+        std::lock_guard<std::mutex> lock { bucket.guard };
+        bucket.queued = false;
+        ++bucket.active;
+    }
+
+    for (files_type files;; files.clear()) {
+        bool requeue = false;
+        {
+            std::lock_guard<std::mutex> lock { bucket.guard };
+            if (bucket.pending.empty() || engine.pipeline->failed) {
+                // the last worker leaving bucket confirms it if no more files can be collected
+                confirm = --bucket.active == 0 && !bucket.queued && !bucket.confirmed &&
+                          engine.pipeline->collected && !engine.pipeline->failed;
+                bucket.confirmed = bucket.confirmed || confirm;
+                break;
+            }
+
+            // elements are moved between lists as is, files aren't reallocated
+            for (size_t i = 0; i < c_refine_batch_size && !bucket.pending.empty(); ++i)
+                files.splice_after(files.before_begin(), bucket.pending, bucket.pending.before_begin());
+
+            requeue = !bucket.pending.empty() && !bucket.queued;
+            bucket.queued = bucket.queued || requeue;
+            d = bucket.device;
+        }
+
+        // rest of pending files is offered to other workers of device, bucket isn't
+        // requeued if queue is full to not block worker being consumer of the queue
+        if (requeue && !d->buckets.try_push(&bucket)) {
+            std::lock_guard<std::mutex> lock { bucket.guard };
+            bucket.queued = false;
+        }
+
+        refine(bucket, files);
+    }
+
+    if (confirm)
+        engine.confirm(bucket);
+}
+
+void SearchEngine::Impl::Worker::refine(Bucket& bucket, files_type& files) {
+    files.reverse(); // keep order of traversal
+
+    // files sharing all extents are equal, so only first of them is compared
+    // and others are attached to the node it's put into
+    candidates.clear();
+    cont::map<std::string, size_t> batch_extents;
+    while (!files.empty()) {
+        const auto& file_path = files.front();
+        std::string signature;
+        if (engine.detect_shared) {
+            if (auto e = file_extents(file_path))
+                signature = std::move(*e);
+        }
+
+        if (!signature.empty()) {
+            std::lock_guard<std::mutex> lock { bucket.shared_guard };
+            auto it = bucket.extents.find(signature);
+            if (it != bucket.extents.end()) {
+                it->second->splice_after(it->second->before_begin(), files, files.before_begin());
+                continue;
+            }
+
+            auto res = batch_extents.emplace(signature, candidates.size());
+            if (!res.second) {
+                auto& shared = candidates[res.first->second].shared;
+                shared.splice_after(shared.before_begin(), files, files.before_begin());
+                continue;
+            }
+        }
+        candidates.push_back(Candidate { {}, std::move(signature), {}, 0. });
+        candidates.back().file.splice_after(candidates.back().file.before_begin(), files, files.before_begin());
+    }
+
+    // files residing in page cache are compared first, so they split bucket by cheap
+    // reads and the most of cold files diverge from them without reading of cold residents
+    if (engine.cached_first && candidates.size() > 1) {
+        for (auto& c : candidates)
+            c.cached = cached_part(c.path(), bucket.file_size);
+        std::stable_sort(candidates.begin(), candidates.end(),
+            [] (const Candidate& lhs, const Candidate& rhs) { return lhs.cached > rhs.cached; });
+    }
+
+    for (auto& c : candidates) {
+        engine.check_stop();
+        if (engine.pipeline->failed) {
+            std::lock_guard<std::mutex> lock { bucket.guard };
+            bucket.interrupted = true;
+            return;
+        }
+
+        // file sharing extents with candidate which can't be opened takes its place
+        while (!process(bucket, c)) {
+            ++engine.pipeline->skipped_files;
+            c.file.clear();
+            if (c.shared.empty())
+                break;
+            c.file.splice_after(c.file.before_begin(), c.shared, c.shared.before_begin());
+        }
+    }
+}
+
+void SearchEngine::Impl::start(bool recursive) {
     clear();
+    reset_heap_counters();
+
+    pipeline.reset(new Pipeline);
+    auto& p = *pipeline;
+
+    bytes_read = 0;
+    p.budget_deadline = time_budget.count() != 0 ? std::chrono::steady_clock::now() + time_budget :
+                                                   SearchEngine::deadline_type::max();
 
     for (const auto& path : paths_scan) {
-        if (!fs::exists(path)) {
+        boost::system::error_code ec;
+        const auto status = fs::status(path, ec);
+        if (!fs::exists(status)) {
             std::cerr << path << " is not exist" << std::endl;
             continue;
         }
 
-        if (fs::is_regular_file(path)) {
-            process(path);
+        if (fs::is_regular_file(status)) {
+            p.scan_files.push_back(path);
             continue;
         }
 
-        if (!fs::is_directory(path)) {
+        if (!fs::is_directory(status)) {
             std::cerr << path << " is not a regular or directory file" << std::endl;
             continue;
         }
 
-        path_exclude_from = path;
+        p.directories.push_back(Directory { path, &path });
+    }
+
+    // worker hashes one part of chunk itself
+    const size_t helpers = large_file_size != 0 && !dry_run ? hash_concurrency - 1 : 0;
+
+    p.enumerating = traversal_concurrency;
+    p.inspecting = traversal_concurrency + 1;
+    p.refining = 1;
+    p.helping = helpers + 1;
+    for (size_t i = 0; i < traversal_concurrency; ++i) {
+        p.threads.emplace_back([this, recursive] { enumerate(recursive); enumerated(); });
+        p.threads.emplace_back([this] { inspect(); inspected(); });
+    }
+    for (size_t i = 0; i < helpers; ++i)
+        p.threads.emplace_back([this] { help(); helped(); });
+}
+
+void SearchEngine::Impl::enumerated() {
+    if (--pipeline->enumerating != 0)
+        return;
+
+    pipeline->files.close();
+    inspected();
+}
+
+void SearchEngine::Impl::inspected() {
+    if (--pipeline->inspecting == 0)
+        traversed();
+}
 
-        if (recursive)
-            std::for_each(
-                fs::recursive_directory_iterator{path}, fs::recursive_directory_iterator{},
-                boost::bind(&Impl::pre_process, this, boost::placeholders::_1));
+void SearchEngine::Impl::refined() {
+    if (--pipeline->refining != 0)
+        return;
+
+    pipeline->parts.close();
+    helped();
+}
+
+void SearchEngine::Impl::helped() {
+    if (--pipeline->helping == 0)
+        finish();
+}
+
+void SearchEngine::Impl::traversed() {
+    auto& p = *pipeline;
+    try {
+        p.files.consume_all([] (fs::path* file_path) { delete file_path; }); // left on failure
+
+        if (schedule != schedule_mode::stream && !p.failed && !dry_run)
+            schedule_buckets();
+
+        // no more files can be put into buckets, so buckets refined before are confirmed here
+        // and others are confirmed by the last worker refining them
+        p.collected = !p.failed;
+        for (auto& r : roots) {
+            if (dry_run)
+                break;
+
+            auto& b = r.second;
+            bool ready;
+            {
+                std::lock_guard<std::mutex> lock { b.guard };
+                ready = b.count > 1 && b.active == 0 && !b.queued && !b.confirmed && !p.failed;
+                b.confirmed = b.confirmed || ready;
+            }
+            if (ready)
+                confirm(b);
+        }
+    } catch (...) {
+        fail();
+    }
+
+    // no more devices are created, so their workers leave when their queues are drained
+    for (auto& d : devices)
+        d.second.buckets.close();
+    refined();
+}
+
+void SearchEngine::Impl::finish() {
+    auto& p = *pipeline;
+    try {
+        // buckets collected by dry run are left as is for estimation
+        if (dry_run) {
+            p.result = p.error;
+        } else {
+            // exhausted budget stops scanning gracefully
+            bool exhausted = false;
+            if (p.error) {
+                try {
+                    std::rethrow_exception(p.error);
+                } catch (const budget_exhausted&) {
+                    exhausted = true;
+                } catch (...) {}
+            }
+
+            report = SearchEngine::Report {};
+            report.completed = !p.failed;
+            report.traversed = p.collected;
+            report.bytes_read = bytes_read;
+            report.skipped_directories = p.skipped_directories;
+            report.skipped_files = p.skipped_files;
+            if (p.perf_available) {
+                for (size_t i = 0; i < p.perf.size(); ++i)
+                    report.phases.push_back(SearchEngine::Report::Phase { c_perf_phase_names[i], p.perf[i] });
+            }
+
+            // bucket containing the only file has never been queued, buckets refined completely
+            // before scanning is stopped are confirmed here, the rest is reported and dropped,
+            // so results contain confirmed groups only
+            for (auto it = roots.begin(); it != roots.end();) {
+                auto& b = it->second;
+                report.files += b.count;
+                if (b.count == 1) {
+                    b.files.swap(b.pending);
+                } else if (!b.confirmed && p.collected && b.pending.empty() && b.active == 0 && !b.interrupted) {
+                    b.confirmed = true;
+                    confirm(b);
+                } else if (!b.confirmed) {
+                    assert(p.failed);
+                    report.unresolved.push_back(SearchEngine::Report::Bucket { b.file_size, b.count });
+                    release(b);
+                    it = roots.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+
+            if (!exhausted)
+                p.result = p.error;
+        }
+    } catch (...) {
+        p.result = std::current_exception();
+    }
+
+    // engine may be released as soon as completion is signaled, so handler is copied before
+    const auto handler = async.on_complete;
+    const auto executor = async.executor;
+    const auto error = p.result;
+    {
+        std::lock_guard<std::mutex> lock { p.guard };
+        p.completed = true;
+        p.cv.notify_all();
+    }
+
+    if (!handler)
+        return;
+    if (executor)
+        executor([handler, error] { handler(error); });
+    else
+        handler(error);
+}
+
+void SearchEngine::Impl::wait() {
+    if (!pipeline)
+        return;
+
+    auto& p = *pipeline;
+    {
+        std::unique_lock<std::mutex> lock { p.guard };
+        p.cv.wait(lock, [&p] { return p.completed; });
+    }
+
+    // engine may be released by completion handler called by the last thread of pipeline
+    const auto join = [] (std::thread& t) {
+        if (!t.joinable())
+            return;
+        if (t.get_id() == std::this_thread::get_id())
+            t.detach();
         else
-            std::for_each(
-                fs::directory_iterator{path}, fs::directory_iterator{},
-                boost::bind(&Impl::pre_process, this, boost::placeholders::_1));
+            t.join();
+    };
+
+    for (auto& t : p.threads)
+        join(t);
+    for (auto& d : devices) {
+        for (auto& t : d.second.workers)
+            join(t);
     }
 }
 
+void SearchEngine::Impl::run(bool recursive) {
+    start(recursive);
+    wait();
+    if (pipeline->result)
+        std::rethrow_exception(pipeline->result);
+}
+
 SearchEngine::Iterator::Impl::Impl(const roots_type& r) 
     : roots(r)
-    , accessor(Accessor::Impl { nullptr })
+    , accessor(Accessor::Impl { nullptr, 0 })
     , root_it(r.end()) {}
 
 SearchEngine::Iterator::Impl::Impl(const roots_type& r, const typename roots_type::const_iterator& it) 
     : roots(r)
-    , accessor(Accessor::Impl { &it->second })
+    , accessor(Accessor::Impl { &it->second, it->first })
     , root_it(it) {}
 
 void SearchEngine::Iterator::Impl::lookup_end_at_left() {
@@ -299,24 +1750,27 @@ void SearchEngine::Iterator::Impl::lookup_end_at_left() {
         accessor.node = nullptr;
         return;
     }
+    accessor.file_size = root_it->first;
 
-    if (!path.empty()) {
-        auto& n = path.front()->second;
-        accessor.node = &n;
+    // trees of large files are as deep as number of their blocks, so they're descended
+    // by loop instead of recursion
+    for (;;) {
+        if (!path.empty()) {
+            auto& n = path.front()->second;
+            accessor.node = &n;
 
-        if (!n.files.empty())
+            if (!n.files.empty())
+                return;
+
+            assert(!n.childs.empty());
+            path.push_front(n.childs.begin());
+        } else if (root_it->second.files.empty()) {
+            path.push_front(root_it->second.childs.begin());
+        } else {
+            accessor.node = &root_it->second;
             return;
-        
-        assert(!n.childs.empty());
-        path.push_front(n.childs.begin());
-    } else if (root_it->second.files.empty()) {
-        path.push_front(root_it->second.childs.begin());
-    } else {
-        accessor.node = &root_it->second;
-        return;
+        }
     }
-
-    lookup_end_at_left();
 }
 
 void SearchEngine::Iterator::Impl::next() {
@@ -389,6 +1843,44 @@ void SearchEngine::Iterator::Accessor::visit(const visitor_type& visitor) const
         visitor(path);
 }
 
+void SearchEngine::Iterator::Accessor::visit_shared(const visitor_type& visitor) const {
+    if (pimpl_->node == nullptr)
+        throw std::logic_error("bad access");
+
+    if (pimpl_->node->shared == nullptr)
+        return;
+
+    for (const auto& path : *pimpl_->node->shared)
+        visitor(path);
+}
+
+uintmax_t SearchEngine::Iterator::Accessor::file_size() const {
+    if (pimpl_->node == nullptr)
+        throw std::logic_error("bad access");
+
+    return pimpl_->file_size;
+}
+
+size_t SearchEngine::Iterator::Accessor::size() const {
+    if (pimpl_->node == nullptr)
+        throw std::logic_error("bad access");
+
+    return pimpl_->node->size();
+}
+
+uintmax_t SearchEngine::Iterator::Accessor::bytes() const {
+    return file_size() * size();
+}
+
+const std::string& SearchEngine::Iterator::Accessor::digest() const {
+    static const std::string c_empty;
+
+    if (pimpl_->node == nullptr)
+        throw std::logic_error("bad access");
+
+    return pimpl_->node->digest ? *pimpl_->node->digest : c_empty;
+}
+
 SearchEngine::Iterator::~Iterator() = default;
 
 SearchEngine::Iterator::Iterator(Impl* impl)
@@ -442,7 +1934,44 @@ auto SearchEngine::end() const -> const_iterator {
 }
 
 void SearchEngine::run(bool recursive) {
+    wait();
+    pimpl_->async = AsyncParams {};
+    pimpl_->run(recursive);
+}
+
+auto SearchEngine::estimate(bool recursive) -> Estimate {
+    wait();
+    pimpl_->async = AsyncParams {};
+    pimpl_->dry_run = true;
+    BOOST_SCOPE_EXIT(&pimpl_) {
+        pimpl_->dry_run = false;
+        pimpl_->clear();
+    } BOOST_SCOPE_EXIT_END;
+
     pimpl_->run(recursive);
+    return pimpl_->estimate();
+}
+
+void SearchEngine::run_async(AsyncParams params) {
+    wait();
+    pimpl_->async = std::move(params);
+    pimpl_->start(pimpl_->async.recursive);
+}
+
+void SearchEngine::record_shape(std::ostream& os) const {
+    pimpl_->record_shape(os);
+}
+
+auto SearchEngine::heap() const -> Heap {
+    return pimpl_->heap();
+}
+
+auto SearchEngine::report() const -> const Report& {
+    return pimpl_->report;
+}
+
+void SearchEngine::wait() {
+    pimpl_->wait();
 }
 
 } // namespace griha
\ No newline at end of file
@@ -5,8 +5,16 @@
 
 #pragma once
 
+#include <iosfwd>
+#include <string>
 #include <vector>
 #include <iterator>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <exception>
+
+#include <sys/types.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
@@ -14,6 +22,8 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/function.hpp>
 
+#include "perf_counters.h"
+
 namespace griha {
 
 enum class hash_algo {
@@ -21,6 +31,35 @@ enum class hash_algo {
     sha256
 };
 
+enum class io_mode {
+    buffered, ///< files are read through page cache
+    fadvise,  ///< files are read through page cache, their pages are dropped after reading
+    direct    ///< files are read by-passing page cache
+};
+
+enum class reader_mode {
+    pread, ///< blocks are read by positional reads, no position of file is kept
+    stdio  ///< blocks are read by unbuffered stdio streams seeked to them
+};
+
+enum class schedule_mode {
+    stream,  ///< files are compared while traversal isn't completed
+    savings, ///< after traversal, buckets wasting the most space are compared first
+    latency  ///< after traversal, buckets requiring the least reading are compared first
+};
+
+/// @brief Token to cancel asynchronous scanning, its copies share the same state
+class CancelToken {
+public:
+    CancelToken() : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { *cancelled_ = true; }
+    bool cancelled() const { return *cancelled_; }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
 class SearchEngine {
 
     struct Impl;
@@ -37,6 +76,7 @@ public:
         class Accessor {
             
             friend class Iterator;
+            friend class SearchEngine;
 
             struct Impl;
 
@@ -54,6 +94,34 @@ public:
 
             void visit(const visitor_type& visitor) const;
 
+            /// @brief Visits files of group sharing physical extents with other files of group
+            /// @note These files are already deduplicated, so they don't waste space
+            void visit_shared(const visitor_type& visitor) const;
+
+            /// @name Metadata of group known without visiting of its files
+            /// @details They are kept by tree of size bucket while it's built, so
+            ///          they cost neither walking of group nor filesystem calls
+            /// @{
+
+            /// @brief Size of each file of group
+            uintmax_t file_size() const;
+
+            /// @brief Number of files of group including shared ones
+            size_t size() const;
+
+            /// @brief Total size of files of group, shared files are counted too
+            uintmax_t bytes() const;
+
+            /// @brief Digest of the last level of content files of group are compared by
+            /// @details It's digest of whole content for files compared as a whole, content
+            ///          itself for files not larger than 64 bytes. Group isn't distinguished
+            ///          by digest from groups of other sizes and of other levels.
+            /// @return Empty string if files of group haven't been read, e.g. the only
+            ///         file of its size
+            const std::string& digest() const;
+
+            /// @}
+
         private:
             explicit Accessor(Impl* impl);
 
@@ -94,15 +162,110 @@ public:
     using iterator = Iterator;
     using const_iterator = Iterator;
 
+    /// @brief Parameters of engine, default constructed ones are defaults of command line
+    /// @note Set fields by name, so new parameters don't break callers
     struct InitParams {
-        hash_algo algo;
-        size_t block_size;
-        size_t file_min_size;
+        hash_algo algo = hash_algo::md5;
+        size_t block_size = 1024;
+        size_t file_min_size = 1;
+        size_t small_file_size = 4096;
+        size_t large_file_size = size_t { 1 } << 30; ///< minimum size of file hashed by chunks in parallel, 0 - never
+        bool detect_shared = false;
+        bool cached_first = false;
+        bool kernel_hash = false;
+        bool perf_counters = false; ///< hardware events are counted by phases of scanning
+        io_mode io = io_mode::buffered;
+        reader_mode reader = reader_mode::pread;
+        schedule_mode schedule = schedule_mode::stream;
+        size_t traversal_concurrency = 4; ///< number of directory enumerators and metadata workers
+        size_t hdd_concurrency = 1; ///< number of workers reading from rotational device
+        size_t ssd_concurrency = 0; ///< number of workers reading from non-rotational device, 0 - number of CPUs
+        size_t hash_concurrency = 0; ///< number of parts of chunk of large file hashed in parallel, 0 - number of CPUs
+        size_t max_read_rate = 0; ///< bytes per second, 0 - unlimited
+        size_t max_iops = 0; ///< read operations per second, 0 - unlimited
+        size_t time_budget = 0; ///< seconds scanning is stopped after, 0 - unlimited
+        uintmax_t read_budget = 0; ///< bytes scanning is stopped after reading of, 0 - unlimited
+        boost::filesystem::path throttle_file; ///< limits of reading are reloaded from
+        const std::atomic<unsigned>* reload_requests = nullptr; ///< limits are reloaded when counter is changed
         paths_type paths_scan;
         paths_type paths_exclude;
         rxpatterns_type rxpatterns;
     };
 
+    /// @brief Results of the last scanning
+    struct Report {
+        struct Bucket {
+            uintmax_t file_size;
+            size_t count;
+        };
+
+        /// @brief Hardware events counted by threads of phase of scanning
+        struct Phase {
+            const char* name;
+            PerfValues values;
+        };
+
+        bool completed = true; ///< all files are compared, no budget is exhausted
+        bool traversed = true; ///< all files are collected, otherwise unresolved buckets may lack files
+        uintmax_t bytes_read = 0;
+        uintmax_t files = 0; ///< number of files collected
+        uintmax_t skipped_directories = 0; ///< directories not listed completely because of errors
+        uintmax_t skipped_files = 0; ///< files left out of results because of errors, e.g. removed ones
+        std::vector<Bucket> unresolved; ///< buckets which files aren't compared completely
+        std::vector<Phase> phases; ///< empty if counting isn't requested or isn't available
+    };
+
+    /// @brief Cost of comparing of files estimated by their sizes without reading them
+    struct Estimate {
+        struct Device {
+            dev_t dev;
+            bool rotational;
+            size_t buckets = 0;     ///< number of sizes having more than one file
+            uintmax_t files = 0;    ///< number of files to be compared
+            uintmax_t bytes = 0;    ///< total size of files to be compared
+            uintmax_t min_read = 0; ///< bytes read if files of the same size differ by the first block
+            uintmax_t min_ops = 0;
+            uintmax_t max_read = 0; ///< bytes read if files of the same size are equal
+            uintmax_t max_ops = 0;
+        };
+
+        uintmax_t files = 0; ///< number of files passed filters
+        std::vector<Device> devices;
+    };
+
+    /// @brief Heap memory held by results of the last scanning by category
+    struct Heap {
+        struct Category {
+            const char* name = nullptr;
+            uintmax_t bytes = 0;       ///< allocated now
+            uintmax_t peak = 0;        ///< maximum allocated during the last scanning
+            uintmax_t blocks = 0;      ///< number of blocks allocated now
+            uintmax_t allocations = 0; ///< number of allocations during the last scanning
+        };
+
+        uintmax_t files = 0; ///< number of files held
+        std::vector<Category> categories;
+    };
+
+    using task_type = boost::function<void ()>;
+    using executor_type = boost::function<void (task_type)>;
+    using group_handler_type = boost::function<void (const Iterator::Accessor&)>;
+    using completion_handler_type = boost::function<void (std::exception_ptr)>;
+    using deadline_type = std::chrono::steady_clock::time_point;
+
+    /// @brief Parameters of asynchronous scanning
+    /// @note Executor runs handlers only. Scanning takes threads of its pipeline like @c run
+    ///       does and no other ones: @c token and @c deadline are checked by them between
+    ///       files and blocks, and the last one completing its stage calls @c on_complete.
+    struct AsyncParams {
+        bool recursive = false;
+        executor_type executor; ///< runs handlers, they're called by scanning threads if it's empty
+        CancelToken token;
+        deadline_type deadline = deadline_type::max();
+        group_handler_type on_group; ///< called for each group of duplicates once it's confirmed
+        completion_handler_type on_complete; ///< called once with error, @c nullptr on success
+    };
+
 public:
     explicit SearchEngine(InitParams init_params);
 
@@ -113,6 +276,50 @@ public:
 
     void run(bool recursive);
 
+    /// @brief Traverses paths and puts files into size buckets without reading of their content
+    /// @return Cost of comparing of collected files, results of engine are left empty
+    Estimate estimate(bool recursive);
+
+    /// @brief Starts scanning without blocking of caller
+    /// @details Group of duplicates is confirmed when traversal is completed and all files
+    ///          of its size are compared, so groups of sizes compared earlier are passed
+    ///          to @c on_group before scanning is completed. Scanning is stopped by
+    ///          @c token or @c deadline, @c on_complete gets @c std::system_error with
+    ///          @c operation_canceled or @c timed_out code in this case. Results left
+    ///          in engine contain confirmed groups only like ones of scanning stopped
+    ///          by exhausted budget, the rest is described by @c report.
+    /// @note Engine mustn't be accessed until @c on_complete is called or @c wait returns
+    void run_async(AsyncParams params);
+
+    /// @brief Waits for completion of asynchronous scanning
+    void wait();
+
+    /// @brief Returns results of the last scanning not contained by groups
+    /// @note Scanning stopped by exhausted budget isn't failed, it's completed
+    ///       gracefully and only confirmed groups are left in engine
+    const Report& report() const;
+
+    /// @brief Writes anonymized shape of the last scanning to be replayed by benchmarks
+    /// @details Trace contains no names and no content, only structure of directories,
+    ///          sizes of files and nodes of trees of size buckets files are put into,
+    ///          so where files of the same size match and diverge. It's line based:
+    ///          @li @c "d <id> <parent-id>" - directory, parent of path to be scanned is @c -
+    ///          @li @c "b <file-size> <level-size>" - size bucket, level is part of content
+    ///              compared at one level of tree
+    ///          @li @c "f <directory-id> <node-path>" - file of the last bucket, path is
+    ///              dot separated indices of nodes from root, @c "i*n" means @c n nodes
+    ///              of index @c i in a row, @c - is root
+    ///          Files of the same node are equal, files of sibling nodes are equal up to
+    ///          their level. Files sharing physical extents are recorded as equal ones.
+    void record_shape(std::ostream& os) const;
+
+    /// @brief Returns heap memory held by engine
+    /// @details Nodes of containers are accounted by their allocators while scanning,
+    ///          counters are shared by all engines of process. Strings of paths and
+    ///          digest keys are counted by walking of trees, they are never released
+    ///          while scanning, so their peak is the current size.
+    Heap heap() const;
+
 private:
     boost::intrusive_ptr<Impl> pimpl_;
 };
@@ -0,0 +1,119 @@
+/// @file   throttle.cpp
+/// @brief  This file contains definition of Throttle class.
+/// @author griha
+
+#include "throttle.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem/operations.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace griha {
+
+Throttle::Throttle(size_t max_read_rate, size_t max_iops, fs::path control_file,
+                   const std::atomic<unsigned>* reload_requests)
+    : control_file_(std::move(control_file))
+    , reload_requests_(!control_file_.empty() ? reload_requests : nullptr)
+    , reloads_(reload_requests_ != nullptr ? reload_requests_->load() : 0)
+    , last_(clock_type::now()) {
+
+    if (!control_file_.empty() && fs::exists(control_file_))
+        read_limits(max_read_rate, max_iops);
+
+    bytes_.reset(max_read_rate);
+    ops_.reset(max_iops);
+    enabled_ = max_read_rate != 0 || max_iops != 0;
+}
+
+void Throttle::Bucket::reset(double r) {
+    rate = r;
+    tokens = r;
+}
+
+void Throttle::Bucket::limit(double r) {
+    rate = r;
+    tokens = std::min(tokens, r);
+}
+
+double Throttle::Bucket::take(double n, double elapsed) {
+    if (rate == 0.)
+        return 0.;
+
+    tokens = std::min(rate, tokens + elapsed * rate) - n;
+    return tokens < 0. ? -tokens / rate : 0.;
+}
+
+bool Throttle::read_limits(size_t& max_read_rate, size_t& max_iops) const {
+    std::ifstream is { control_file_.string() };
+    if (!is) {
+        std::cerr << control_file_ << " can't be read, limits of reading are kept" << std::endl;
+        return false;
+    }
+
+    size_t rate = 0, iops = 0;
+    try {
+        for (std::string line; std::getline(is, line);) {
+            const auto pos = line.find('=');
+            if (pos == std::string::npos)
+                continue;
+
+            const auto key = line.substr(0, pos);
+            const auto value = std::stoull(line.substr(pos + 1));
+            if (key == "max-read-rate")
+                rate = value;
+            else if (key == "max-iops")
+                iops = value;
+        }
+    } catch (const std::exception&) {
+        std::cerr << control_file_ << " is malformed, limits of reading are kept" << std::endl;
+        return false;
+    }
+
+    max_read_rate = rate;
+    max_iops = iops;
+    return true;
+}
+
+void Throttle::reload() {
+    size_t max_read_rate, max_iops;
+    if (!read_limits(max_read_rate, max_iops))
+        return;
+
+    std::lock_guard<std::mutex> lock { guard_ };
+    bytes_.limit(max_read_rate);
+    ops_.limit(max_iops);
+    enabled_ = max_read_rate != 0 || max_iops != 0;
+}
+
+void Throttle::acquire(size_t size) {
+    if (reload_requests_ != nullptr) {
+        // one of reading threads of engine reloads limits for each change of counter
+        auto seen = reloads_.load(std::memory_order_relaxed);
+        const auto requested = reload_requests_->load(std::memory_order_relaxed);
+        if (seen != requested && reloads_.compare_exchange_strong(seen, requested))
+            reload();
+    }
+
+    if (!enabled_)
+        return;
+
+    double wait;
+    {
+        std::lock_guard<std::mutex> lock { guard_ };
+        const auto now = clock_type::now();
+        const std::chrono::duration<double> elapsed = now - last_;
+        last_ = now;
+        wait = std::max(bytes_.take(size, elapsed.count()), ops_.take(1., elapsed.count()));
+    }
+
+    if (wait > 0.)
+        std::this_thread::sleep_for(std::chrono::duration<double> { wait });
+}
+
+} // namespace griha
@@ -0,0 +1,70 @@
+/// @file   throttle.h
+/// @brief  This file contains declaration of Throttle class limiting bandwidth and
+///         rate of read operations.
+/// @author griha
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <boost/filesystem/path.hpp>
+
+namespace griha {
+
+class Throttle {
+public:
+    /// @param max_read_rate Maximum number of bytes read per second, 0 - unlimited
+    /// @param max_iops Maximum number of read operations per second, 0 - unlimited
+    /// @param control_file Path to file limits are reloaded from. File contains lines
+    ///        @c max-read-rate=N and @c max-iops=N. If path is empty limits can't be
+    ///        changed at runtime.
+    /// @param reload_requests Counter of requests to reload limits owned by caller, e.g.
+    ///        incremented by handler of @c SIGHUP signal, limits are reloaded by the first
+    ///        read after it's changed. May be null.
+    Throttle(size_t max_read_rate, size_t max_iops, boost::filesystem::path control_file,
+             const std::atomic<unsigned>* reload_requests);
+
+    Throttle(const Throttle&) = delete;
+    Throttle& operator= (const Throttle&) = delete;
+
+    /// @brief Blocks caller until read operation of @c size bytes fits limits
+    /// @note Limits are kept by token buckets, the whole second of unused bandwidth
+    ///       can be consumed by burst
+    void acquire(size_t size);
+
+private:
+    using clock_type = std::chrono::steady_clock;
+
+    struct Bucket {
+        double rate = 0.; ///< tokens per second, 0 - unlimited
+        double tokens = 0.;
+
+        void reset(double r);
+
+        /// @brief Changes rate keeping tokens left, so burst isn't refilled by reloading
+        void limit(double r);
+
+        /// @return Time in seconds to wait for debt to be paid
+        double take(double n, double elapsed);
+    };
+
+    /// @return @c false if control file can't be read, limits are left untouched then
+    bool read_limits(size_t& max_read_rate, size_t& max_iops) const;
+
+    void reload();
+
+private:
+    const boost::filesystem::path control_file_;
+    const std::atomic<unsigned>* const reload_requests_;
+    std::atomic<unsigned> reloads_; ///< value of counter of requests limits are reloaded for
+
+    std::atomic<bool> enabled_;
+    std::mutex guard_;
+    clock_type::time_point last_;
+    Bucket bytes_;
+    Bucket ops_;
+};
+
+} // namespace griha